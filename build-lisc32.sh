@@ -29,7 +29,8 @@ rm -rf ../patch/lisc-patch.tar.gz
 cd ..
 
 build_project fesvr --prefix=$LISC
-build_project isa-sim --prefix=$LISC --with-fesvr=$LISC
+# LISC32: 32-bit harts only, with the register width fixed at compile time.
+build_project isa-sim --prefix=$LISC --with-fesvr=$LISC --with-isa=RV32IMC CPPFLAGS=-DLISC32
 
 if [ ! -e toolchain ]
 then
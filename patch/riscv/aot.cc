@@ -0,0 +1,131 @@
+// See LICENSE for license details.
+
+#include "aot.h"
+#include "sim.h"
+#include "mmu.h"
+#include <fesvr/option_parser.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+aot_table_t& aot_table_t::registered()
+{
+  static aot_table_t table;
+  return table;
+}
+
+void aot_table_t::add(const aot_block_desc_t* blocks, size_t n, unsigned xlen)
+{
+  this->xlen = xlen;
+  for (size_t i = 0; i < n; i++) {
+    insert(&blocks[i]);
+
+    // Stores into the translated code must be noticed, as for cached blocks.
+    reg_t end = blocks[i].pc;
+    for (size_t k = 0; k < blocks[i].length; k++)
+      end += insn_length(blocks[i].bits[k]);
+    mark_code_lines(blocks[i].pc, end);
+  }
+}
+
+void aot_table_t::insert(const aot_block_desc_t* desc)
+{
+  if (2 * (count + 1) > table.size()) {
+    std::vector<entry_t> old(table.size() * 2);
+    old.swap(table);
+    mask = table.size() - 1;
+    count = 0;
+    for (auto& e : old)
+      if (e.desc)
+        insert(e.desc);
+  }
+
+  size_t i = (desc->pc / PC_ALIGN) & mask;
+  while (table[i].desc)
+    i = (i + 1) & mask;
+  table[i].pc = desc->pc;
+  table[i].desc = desc;
+  table[i].generation.store(0, std::memory_order_relaxed);
+  table[i].dropped.store(false, std::memory_order_relaxed);
+  count++;
+}
+
+bool aot_table_t::usable(processor_t* p)
+{
+  return count > 0 && xlen == p->get_max_xlen();
+}
+
+// Some code has been stored to since e was last checked; make sure its
+// instruction words are still the ones it was translated from.  Other harts
+// may be doing the same for e; they all reach the same answer.  The
+// generation is read before the words, so a store that lands after they were
+// checked still bumps it past what is recorded here.
+bool aot_table_t::revalidate(processor_t* p, entry_t* e)
+{
+  if (e->dropped.load(std::memory_order_relaxed))
+    return false;
+
+  uint64_t generation = __atomic_load_n(&code_generation, __ATOMIC_ACQUIRE);
+  reg_t end = e->pc;
+  for (size_t k = 0; k < e->desc->length; k++)
+    end += insn_length(e->desc->bits[k]);
+  // A write clears the map bit of the line it hit.
+  mark_code_lines(e->pc, end);
+
+  reg_t pc = e->pc;
+  try {
+    for (size_t k = 0; k < e->desc->length; k++) {
+      insn_bits_t bits = p->get_mmu()->load_insn(pc).insn.bits();
+      if (bits != e->desc->bits[k]) {
+        e->dropped.store(true, std::memory_order_relaxed);
+        return false;
+      }
+      pc += insn_length(bits);
+    }
+  } catch (trap_t& t) {
+    // Not fetchable right now; let the interpreter take the fault.
+    return false;
+  }
+
+  e->generation.store(generation, std::memory_order_release);
+  return true;
+}
+
+static void help()
+{
+  fprintf(stderr, "usage: <translated program> [options] <target program> [args]\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -p<n>                 Simulate <n> processors [default 1]\n");
+  fprintf(stderr, "  -m<n>                 Provide <n> MiB of target memory [default 2048]\n");
+  fprintf(stderr, "  --isa=<name>          RISC-V ISA string [default %s]\n", DEFAULT_ISA);
+  exit(1);
+}
+
+int aot_main(int argc, char** argv)
+{
+  size_t nprocs = 1;
+  size_t mem_mb = 2048;
+  const char* isa = DEFAULT_ISA;
+
+  option_parser_t parser;
+  parser.help(&help);
+  parser.option('h', 0, 0, [&](const char* s){help();});
+  parser.option('p', 0, 1, [&](const char* s){nprocs = atoi(s);});
+  parser.option('m', 0, 1, [&](const char* s){mem_mb = atoi(s);});
+  parser.option(0, "isa", 1, [&](const char* s){isa = s;});
+
+  auto argv1 = parser.parse(argv);
+  std::vector<std::string> htif_args(argv1, (const char*const*)argv + argc);
+  if (htif_args.empty())
+    help();
+
+  std::vector<std::pair<reg_t, mem_t*>> mems(1,
+    std::make_pair(reg_t(DRAM_BASE), new mem_t(reg_t(mem_mb) << 20)));
+
+  sim_t s(isa, nprocs, false, reg_t(-1), mems, htif_args, std::vector<int>(),
+          2, 0, false);
+  auto return_code = s.run();
+
+  for (auto& mem : mems)
+    delete mem.second;
+  return return_code;
+}
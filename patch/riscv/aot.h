@@ -0,0 +1,105 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_AOT_H
+#define _RISCV_AOT_H
+
+#include "decode.h"
+#include <atomic>
+#include <vector>
+
+class processor_t;
+
+// Where a translated block had got to, for the block loop to recover the PC
+// and retired count if an op traps or leaves the block early.
+struct aot_frame_t
+{
+  reg_t pc;         // PC of op n
+  size_t n;         // index of the op being run
+};
+
+// Runs the block and returns what its last executed op returned.
+typedef reg_t (*aot_func_t)(processor_t* p, aot_frame_t* f);
+
+// One basic block of a statically translated LISC program, as emitted by
+// lisc-aot.
+struct aot_block_desc_t
+{
+  reg_t pc;
+  aot_func_t func;
+  size_t length;              // number of ops
+  bool flushes;               // last op may invalidate cached blocks
+  const insn_bits_t* bits;    // the instruction words it was built from
+};
+
+// Statically translated blocks linked into this executable, by entry PC.
+// An entry whose instruction words have since been overwritten is dropped,
+// and that code goes back to the interpreter.  Harts on the hart pool look
+// entries up and revalidate them concurrently, so the validation state is
+// atomic; the rest is only written before the harts start.
+class aot_table_t
+{
+public:
+  struct entry_t
+  {
+    reg_t pc;
+    const aot_block_desc_t* desc;
+    std::atomic<uint64_t> generation; // code_generation it was last checked at
+    std::atomic<bool> dropped;        // overwritten since translation
+  };
+
+  static aot_table_t& registered();
+
+  void add(const aot_block_desc_t* blocks, size_t n, unsigned xlen);
+  bool usable(processor_t* p);
+
+  inline const aot_block_desc_t* lookup(processor_t* p, reg_t pc)
+  {
+    for (size_t i = (pc / PC_ALIGN) & mask; ; i = (i + 1) & mask) {
+      entry_t* e = &table[i];
+      if (e->desc == NULL)
+        return NULL;
+      if (e->pc == pc) {
+        if (unlikely(e->generation.load(std::memory_order_acquire) != code_generation) &&
+            !revalidate(p, e))
+          return NULL;
+        return e->desc;
+      }
+    }
+  }
+
+private:
+  std::vector<entry_t> table;
+  size_t mask;
+  size_t count;
+  unsigned xlen;
+
+  aot_table_t() : table(1), mask(0), count(0), xlen(0) {}
+  void insert(const aot_block_desc_t* desc);
+  bool revalidate(processor_t* p, entry_t* e);
+};
+
+struct aot_registration_t
+{
+  aot_registration_t(const aot_block_desc_t* blocks, size_t n, unsigned xlen)
+  {
+    aot_table_t::registered().add(blocks, n, xlen);
+  }
+};
+
+// Entry point of a translated program: runs the ELF named on the command
+// line, like spike, using the blocks registered above wherever they apply.
+int aot_main(int argc, char** argv);
+
+// Used by generated blocks.  Op k at pc_ is expected to continue at next_;
+// anything else leaves the block.
+#define AOT_OP(k, pc_, name, bits_, next_) \
+  f->pc = (pc_); f->n = (k); \
+  npc = aot_##name(p, insn_t(bits_), (pc_)); \
+  if (unlikely(npc != (next_))) \
+    return npc;
+
+#define AOT_LAST(k, pc_, name, bits_) \
+  f->pc = (pc_); f->n = (k); \
+  return aot_##name(p, insn_t(bits_), (pc_));
+
+#endif
@@ -0,0 +1,379 @@
+// See LICENSE for license details.
+
+#include "block_cache.h"
+#include "jit.h"
+#include "insn_decode.h"
+#include "insn_variant.h"
+#include "processor.h"
+#include "mmu.h"
+#include <algorithm>
+#include <string.h>
+
+#define DEFINE_INSN(name) extern const insn_variants_t name##_variants;
+#include "insn_list.h"
+#undef DEFINE_INSN
+
+static const insn_variants_t* const insn_variants[NUM_INSNS] = {
+#define DEFINE_INSN(name) &name##_variants,
+#include "insn_list.h"
+#undef DEFINE_INSN
+};
+
+uint64_t code_line_map[(1 << CODE_MAP_BITS) / 64];
+uint64_t code_line_writes[CODE_WRITE_LOG];
+volatile uint64_t code_generation;
+
+void mark_code_lines(reg_t start, reg_t end)
+{
+  for (reg_t line = start >> CODE_LINE_SHIFT; line <= (end - 1) >> CODE_LINE_SHIFT; line++) {
+    reg_t idx = line & ((1 << CODE_MAP_BITS) - 1);
+    __atomic_fetch_or(&code_line_map[idx / 64], uint64_t(1) << (idx % 64), __ATOMIC_RELAXED);
+  }
+}
+
+// Map line idx was stored to.  Write number n goes in slot n % CODE_WRITE_LOG
+// tagged with n + 1, so a cache catching up can tell a slot that has not
+// been filled in yet, or has been reused, from the one it wants.
+void code_line_written(reg_t idx)
+{
+  __atomic_fetch_and(&code_line_map[idx / 64], ~(uint64_t(1) << (idx % 64)), __ATOMIC_RELAXED);
+  uint64_t n = __atomic_fetch_add(&code_generation, 1, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&code_line_writes[n % CODE_WRITE_LOG],
+                   (n + 1) << CODE_MAP_BITS | idx, __ATOMIC_RELEASE);
+}
+
+// Any of the code may have changed (a snapshot was restored).  Every cache
+// is more than a log's length behind afterwards, so each flushes.
+void code_lines_reset()
+{
+  memset(code_line_map, 0, sizeof(code_line_map));
+  __atomic_fetch_add(&code_generation, CODE_WRITE_LOG + 1, __ATOMIC_RELEASE);
+}
+
+block_cache_t::block_cache_t(processor_t* proc)
+  : jit(NULL), proc(proc), arena(new block_op_t[ARENA_INSNS]), arena_used(0)
+{
+  flush();
+}
+
+block_cache_t::~block_cache_t()
+{
+  delete [] arena;
+  delete jit;
+}
+
+void block_cache_t::flush()
+{
+  for (size_t i = 0; i < BLOCK_CACHE_ENTRIES; i++) {
+    blocks[i].tag = -1;
+    blocks[i].link = NULL;
+  }
+  arena_used = 0;
+  generation = code_generation;
+  if (jit)
+    jit->flush();
+}
+
+// Catch up with the code lines written since this cache last looked, by
+// dropping the blocks on them; flush if it has fallen too far behind to
+// know which they were.
+void block_cache_t::catch_up()
+{
+  uint64_t now = __atomic_load_n(&code_generation, __ATOMIC_ACQUIRE);
+  if (now - generation > CODE_WRITE_LOG) {
+    flush();
+    return;
+  }
+
+  for (; generation != now; generation++) {
+    uint64_t w = __atomic_load_n(&code_line_writes[generation % CODE_WRITE_LOG], __ATOMIC_ACQUIRE);
+    if (w >> CODE_MAP_BITS != generation + 1) {
+      flush();
+      return;
+    }
+    drop_line(w & ((1 << CODE_MAP_BITS) - 1));
+  }
+}
+
+// Drop every block with code on a line that maps to idx.
+void block_cache_t::drop_line(reg_t idx)
+{
+  const reg_t mask = (1 << CODE_MAP_BITS) - 1;
+  for (size_t i = 0; i < BLOCK_CACHE_ENTRIES; i++) {
+    block_t* b = &blocks[i];
+    if (b->tag == reg_t(-1))
+      continue;
+    reg_t first = b->code_start >> CODE_LINE_SHIFT;
+    reg_t last = (b->code_end - 1) >> CODE_LINE_SHIFT;
+    if (((idx - first) & mask) <= last - first) {
+      b->tag = -1;
+      b->link = NULL;
+      b->native = NULL;
+    }
+  }
+}
+
+void block_cache_t::set_jit(bool enable)
+{
+  flush();
+  delete jit;
+  jit = NULL;
+
+  if (enable) {
+    jit = new jit_t(proc);
+    if (!jit->usable()) {
+      delete jit;
+      jit = NULL;
+    }
+  }
+}
+
+void block_cache_t::translate(block_t* b)
+{
+  b->native = jit->translate(b);
+  if (b->native || !jit->full())
+    return;
+
+  // The code buffer ran out.  Start it again, sending every translated
+  // block back to the interpreter until it is hot again, and retry b.
+  for (size_t i = 0; i < BLOCK_CACHE_ENTRIES; i++) {
+    if (blocks[i].native) {
+      blocks[i].native = NULL;
+      blocks[i].entries = 0;
+    }
+  }
+  jit->flush();
+  b->native = jit->translate(b);
+}
+
+bool block_cache_t::is_cond_branch(insn_bits_t bits)
+{
+  switch (insn_decode(bits)) {
+    case INSN_beq:
+    case INSN_bne:
+    case INSN_blt:
+    case INSN_bge:
+    case INSN_bltu:
+    case INSN_bgeu:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool block_cache_t::ends_block(insn_bits_t bits)
+{
+  switch (insn_decode(bits)) {
+    case INSN_beq:
+    case INSN_bne:
+    case INSN_blt:
+    case INSN_bge:
+    case INSN_bltu:
+    case INSN_bgeu:
+    case INSN_j:
+    case INSN_jal:
+    case INSN_jr:
+    case INSN_jalr:
+    case INSN_c_j:
+    case INSN_c_jal:
+    case INSN_c_jr:
+    case INSN_c_jalr:
+    case INSN_c_beqz:
+    case INSN_c_bnez:
+    case INSN_c_ebreak:
+    case INSN_ecall:
+    case INSN_ebreak:
+    case INSN_mret:
+    case INSN_wfi:
+    case INSN_csrrw:
+    case INSN_csrrs:
+    case INSN_csrrc:
+    case INSN_csrrwi:
+    case INSN_csrrsi:
+    case INSN_csrrci:
+    // fence.i may have changed the code that follows it.
+    case INSN_fence_i:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool block_cache_t::flushes_blocks(insn_bits_t bits)
+{
+  switch (insn_decode(bits)) {
+    case INSN_fence_i:
+      return true;
+    case INSN_csrrw:
+    case INSN_csrrs:
+    case INSN_csrrc:
+    case INSN_csrrwi:
+    case INSN_csrrsi:
+    case INSN_csrrci:
+      break;
+    default:
+      return false;
+  }
+
+  int csr = (bits >> 12) & 0xfff;
+  return csr == CSR_SATP || csr == CSR_MSTATUS || csr == CSR_SSTATUS ||
+         csr == CSR_MISA || (csr >= CSR_PMPCFG0 && csr <= CSR_PMPADDR15);
+}
+
+block_op_t* block_cache_t::alloc(size_t n)
+{
+  if (arena_used + n > ARENA_INSNS)
+    flush();
+  block_op_t* ops = arena + arena_used;
+  arena_used += n;
+  return ops;
+}
+
+// True if insn gets a fast counter read, which has to start its block: the
+// block loop brings minstret up to date only between blocks.
+bool block_cache_t::syncs_instret(insn_t insn)
+{
+  return csr_reads_counter(insn.csr()) && find_fast_csr(insn, proc->get_max_xlen());
+}
+
+// Append the ops of the basic block at pc and return the PC that follows
+// its last op.  Only the first fetch may fault, which is the fault the hart
+// would take anyway; the rest are kept on the same page as pc.
+reg_t block_cache_t::decode(reg_t pc, std::vector<block_op_t>& ops)
+{
+  mmu_t* mmu = proc->get_mmu();
+  reg_t addr = pc;
+  size_t start = ops.size(), n = 0;
+  // An extension may have registered handlers over ours.
+  bool table = proc->get_extension() == NULL;
+  bool rv64 = proc->get_max_xlen() == 64;
+
+  while (true) {
+    insn_bits_t bits = mmu->load_insn_bits(addr);
+    insn_index_t index = table ? insn_decode(bits) : INSN_UNKNOWN;
+    insn_fetch_t fetch;
+    if (index != INSN_UNKNOWN) {
+      const insn_variants_t* v = insn_variants[index];
+      fetch.insn = insn_t(bits);
+      fetch.func = v->select(rv64 ? v->rv64 : v->rv32, fetch.insn);
+    } else {
+      // Not one of ours, so illegal or an extension's: let the processor's
+      // own decoder find its handler.
+      fetch = mmu->load_insn(addr);
+    }
+    if (insn_func_t fast = find_fast_csr(fetch.insn, proc->get_max_xlen())) {
+      if (n > 0 && csr_reads_counter(fetch.insn.csr()))
+        break;
+      fetch.func = fast;
+    }
+    addr += fetch.insn.length();
+    ops.push_back({fetch, addr, NULL});
+    n++;
+
+    if (ends_block(fetch.insn.bits()) || n == MAX_BLOCK_INSNS)
+      break;
+    if ((addr ^ pc) & ~(PGSIZE - 1))
+      break;
+    if ((addr & (PGSIZE - 1)) + MAX_INSN_LENGTH > PGSIZE)
+      break;
+  }
+
+  for (size_t k = start; k + 1 < ops.size(); k++)
+    ops[k].fused = find_fusion(&ops[k], proc->get_max_xlen());
+
+  mark_code_lines(pc, addr);
+  return addr;
+}
+
+block_t* block_cache_t::fill(block_t* b, reg_t pc, reg_t prv)
+{
+  std::vector<block_op_t> ops;
+  reg_t end = decode(pc, ops);
+
+  block_op_t* dst = alloc(ops.size());
+  std::copy(ops.begin(), ops.end(), dst);
+
+  b->tag = pc;
+  b->prv = prv;
+  b->length = ops.size();
+  b->ops = dst;
+  b->fallthrough = end;
+  b->code_start = pc;
+  b->code_end = end;
+  b->cond_branch = is_cond_branch(ops.back().fetch.insn.bits());
+  b->superblock = false;
+  b->syncs_instret = syncs_instret(ops[0].fetch.insn);
+  b->execs = b->taken = 0;
+  b->link = NULL;
+  b->entries = 0;
+  b->native = NULL;
+  return b;
+}
+
+// b's closing branch has become hot towards target.  Replace b with a
+// superblock that follows the hot path through the blocks after it, so a
+// loop of a few blocks runs without going back through lookup().
+void block_cache_t::build_superblock(block_t* b, reg_t target)
+{
+  reg_t head = b->tag, prv = b->prv;
+  std::vector<block_op_t> ops(b->ops, b->ops + b->length);
+  std::vector<reg_t> visited(1, head);
+  reg_t code_start = b->code_start, code_end = b->code_end;
+  ops.back().next = target;
+
+  try {
+    reg_t pc = target;
+    while (std::find(visited.begin(), visited.end(), pc) == visited.end()) {
+      visited.push_back(pc);
+      size_t start = ops.size();
+      reg_t fallthrough = decode(pc, ops);
+      code_start = std::min(code_start, pc);
+      code_end = std::max(code_end, fallthrough);
+      if (ops.size() > MAX_SUPERBLOCK_INSNS || syncs_instret(ops[start].fetch.insn)) {
+        ops.resize(start);
+        break;
+      }
+
+      // Keep going only through branches whose hot direction is known
+      // and through direct jumps.
+      insn_t last = ops.back().fetch.insn;
+      reg_t last_pc = fallthrough - last.length();
+      if (is_cond_branch(last.bits())) {
+        block_t* seen = &blocks[index(pc)];
+        bool taken = seen->tag == pc && seen->prv == prv && !seen->superblock &&
+                     seen->taken * 2 > seen->execs;
+        pc = taken ? last_pc + last.sb_imm() : fallthrough;
+      } else if ((last.bits() & MASK_J) == MATCH_J ||
+                 (last.bits() & MASK_JAL) == MATCH_JAL) {
+        pc = last_pc + last.uj_imm();
+      } else {
+        break;
+      }
+      ops.back().next = pc;
+    }
+  } catch (trap_t& t) {
+    // A fetch along the hot path faulted; stop the superblock before it.
+  }
+
+  if (ops.size() == b->length)
+    return;
+
+  block_op_t* dst = alloc(ops.size());
+  std::copy(ops.begin(), ops.end(), dst);
+
+  block_t* sb = &blocks[index(head)];
+  sb->tag = head;
+  sb->prv = prv;
+  sb->length = ops.size();
+  sb->ops = dst;
+  sb->fallthrough = ops.back().next;
+  sb->code_start = code_start;
+  sb->code_end = code_end;
+  sb->cond_branch = false;
+  sb->superblock = true;
+  sb->syncs_instret = syncs_instret(ops[0].fetch.insn);
+  sb->execs = sb->taken = 0;
+  sb->link = NULL;
+  sb->entries = 0;
+  sb->native = NULL;
+}
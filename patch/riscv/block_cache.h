@@ -0,0 +1,145 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_BLOCK_CACHE_H
+#define _RISCV_BLOCK_CACHE_H
+
+#include "decode.h"
+#include "mmu.h"
+#include <vector>
+
+class processor_t;
+class jit_t;
+struct jit_frame_t;
+typedef size_t (*jit_code_t)(jit_frame_t*);
+
+struct block_op_t;
+
+// Runs pair[0] and pair[1] as one op and returns what pair[1] would have.
+// If pair[1] has to run on its own, because it would trap or it jumps to
+// itself, only pair[0] is run and pair[0].next is returned.
+typedef reg_t (*fused_func_t)(processor_t* p, block_op_t* pair, reg_t pc);
+
+struct block_op_t
+{
+  insn_fetch_t fetch;
+  reg_t next;       // PC the block expects this op to continue at
+  fused_func_t fused; // runs this op and the one after it together, if set
+};
+
+// The handler for a pair of ops that form one of the idioms the toolchain
+// emits (lui+addi, auipc+jr/jalr, slli+srli, slt*+beq/bne), or NULL.
+fused_func_t find_fusion(block_op_t* pair, unsigned xlen);
+
+// CSR classification (fast_csr.cc).  A side-effect-free access cannot change
+// privilege, translation or interrupt state; of those, a counter read also
+// needs minstret to be current.
+bool csr_is_side_effect_free(int csr, bool write);
+bool csr_reads_counter(int csr);
+// A handler for insn that skips serialization, or NULL if it must serialize.
+insn_func_t find_fast_csr(insn_t insn, unsigned xlen);
+
+// A straight-line run of LISC instructions, already fetched and decoded.
+// Any op that returns something other than its expected next PC leaves the
+// block.  Plain blocks only branch at their last op; superblocks also carry
+// the hot direction of the conditional branches inside them.
+struct block_t
+{
+  reg_t tag;        // entry PC
+  reg_t prv;        // privilege the block was fetched under
+  size_t length;    // number of ops
+  block_op_t* ops;
+  reg_t fallthrough; // PC after the last op when it does not branch
+  reg_t code_start; // lowest address of its instructions ...
+  reg_t code_end;   // ... and just past the highest
+  bool cond_branch; // last op is beq/bne/blt/bge/bltu/bgeu
+  bool superblock;
+  bool syncs_instret; // first op reads a counter; minstret must be current
+  size_t execs;     // exits through the last op
+  size_t taken;     // ... of which took the conditional branch
+  block_t* link;    // block this one last exited to
+  unsigned entries; // times dispatched, until it is translated
+  jit_code_t native; // translation of the whole block, if any
+};
+
+class block_cache_t
+{
+public:
+  static const size_t BLOCK_CACHE_ENTRIES = 4096;
+  static const size_t MAX_BLOCK_INSNS = 64;
+  static const size_t MAX_SUPERBLOCK_INSNS = 256;
+  static const size_t ARENA_INSNS = 16 * 1024;
+  static const size_t HOT_BRANCH_THRESHOLD = 64;
+  static const unsigned JIT_THRESHOLD = 256;
+
+  block_cache_t(processor_t* proc);
+  ~block_cache_t();
+
+  inline block_t* lookup(reg_t pc, reg_t prv)
+  {
+    if (unlikely(generation != code_generation))
+      catch_up();
+    block_t* b = &blocks[index(pc)];
+    if (likely(b->tag == pc && b->prv == prv))
+      return b;
+    return fill(b, pc, prv);
+  }
+
+  // Follow b's exit to pc, reusing the chained successor while it is still
+  // the block for pc.
+  inline block_t* next(block_t* b, reg_t pc, reg_t prv)
+  {
+    block_t* succ = b->link;
+    if (likely(succ && succ->tag == pc && succ->prv == prv &&
+               generation == code_generation))
+      return succ;
+    return b->link = lookup(pc, prv);
+  }
+
+  // Called after b's last op ran and execution moved on to pc.
+  inline void profile(block_t* b, reg_t pc)
+  {
+    if (!b->cond_branch || b->superblock)
+      return;
+    b->execs++;
+    if (pc != b->fallthrough && ++b->taken == HOT_BRANCH_THRESHOLD)
+      build_superblock(b, pc);
+  }
+
+  // Count a dispatch of b, translating it once it is hot.
+  inline void enter(block_t* b)
+  {
+    if (jit && ++b->entries == JIT_THRESHOLD)
+      translate(b);
+  }
+
+  void flush();
+  void set_jit(bool enable);
+
+  jit_t* jit;       // NULL unless translation is enabled
+
+  // True if bits must be the last instruction of a block.
+  static bool ends_block(insn_bits_t bits);
+  // True if executing bits may change the code or translation seen by
+  // previously built blocks.
+  static bool flushes_blocks(insn_bits_t bits);
+  static bool is_cond_branch(insn_bits_t bits);
+
+private:
+  processor_t* proc;
+  block_t blocks[BLOCK_CACHE_ENTRIES];
+  block_op_t* arena;
+  size_t arena_used;
+  uint64_t generation;
+
+  static size_t index(reg_t pc) { return (pc / PC_ALIGN) % BLOCK_CACHE_ENTRIES; }
+  void catch_up();
+  void drop_line(reg_t idx);
+  block_op_t* alloc(size_t n);
+  bool syncs_instret(insn_t insn);
+  reg_t decode(reg_t pc, std::vector<block_op_t>& ops);
+  block_t* fill(block_t* b, reg_t pc, reg_t prv);
+  void build_superblock(block_t* b, reg_t target);
+  void translate(block_t* b);
+};
+
+#endif
@@ -0,0 +1,284 @@
+// See LICENSE for license details.
+
+// In-memory checkpoints for reverse execution.  Every interval steps (see
+// set_checkpoints) a checkpoint saves the machine state and the pages
+// written since the one before, so going back to one only has to put back
+// the pages written since.  Reverse execution restores the last checkpoint
+// before the point it wants and runs forward to it again; that needs the
+// simulation to be deterministic, so while checkpoints are on the harts run
+// on one thread.  The host is not: running a syscall again could print
+// twice or read different input.  So whatever it writes into the target is
+// kept along with when, and up to the furthest point the simulation has
+// reached, the host's turns are replayed from that instead of handing it
+// control (see host_turn).  As with snapshots, the debug module's state is
+// not saved.
+
+#include "sim.h"
+#include "checkpoint.h"
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static dirty_pages_t* tracked;
+static struct sigaction old_segv, old_bus;
+
+dirty_pages_t::dirty_pages_t(const std::vector<std::pair<char*, size_t>>& mems)
+  : page_size(sysconf(_SC_PAGESIZE))
+{
+  for (auto& m : mems) {
+    region_t r;
+    r.start = m.first;
+    r.end = m.first + m.second;
+    r.base = (char*)((uintptr_t)r.start / page_size * page_size);
+    r.npages = (r.end - r.base + page_size - 1) / page_size;
+    r.first_full = r.start == r.base ? 0 : 1;
+    r.end_full = (uintptr_t)r.end % page_size == 0 ? r.npages : r.npages - 1;
+    r.end_full = std::max(r.end_full, r.first_full);
+    r.written.resize((r.npages + 63) / 64);
+    regions.push_back(r);
+  }
+
+  tracked = this;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = &handle_fault;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, &old_segv);
+  sigaction(SIGBUS, &sa, &old_bus);
+
+  for (auto& r : regions)
+    protect(r, r.first_full, r.end_full - r.first_full, false);
+}
+
+dirty_pages_t::~dirty_pages_t()
+{
+  for (auto& r : regions)
+    protect(r, r.first_full, r.end_full - r.first_full, true);
+  sigaction(SIGSEGV, &old_segv, NULL);
+  sigaction(SIGBUS, &old_bus, NULL);
+  tracked = NULL;
+}
+
+void dirty_pages_t::protect(const region_t& r, size_t first, size_t n, bool writable)
+{
+  if (n == 0)
+    return;
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  if (mprotect(r.base + first * page_size, n * page_size, prot) != 0) {
+    perror("checkpoint: mprotect");
+    exit(1);
+  }
+}
+
+// Called from the fault handler, so it does no more than it has to.
+bool dirty_pages_t::mark(char* addr)
+{
+  for (auto& r : regions) {
+    if (addr < r.base + r.first_full * page_size || addr >= r.base + r.end_full * page_size)
+      continue;
+    size_t i = (addr - r.base) / page_size;
+    __atomic_fetch_or(&r.written[i / 64], uint64_t(1) << (i % 64), __ATOMIC_RELAXED);
+    return mprotect(r.base + i * page_size, page_size, PROT_READ | PROT_WRITE) == 0;
+  }
+  return false;
+}
+
+void dirty_pages_t::handle_fault(int sig, siginfo_t* info, void* context)
+{
+  if (tracked && tracked->mark((char*)info->si_addr))
+    return;
+  // Not a store to tracked memory: put the old handler back, and the
+  // faulting instruction fails again the way it would have.
+  sigaction(sig, sig == SIGSEGV ? &old_segv : &old_bus, NULL);
+}
+
+std::vector<uint64_t> dirty_pages_t::collect()
+{
+  std::vector<uint64_t> ids;
+  for (size_t n = 0; n < regions.size(); n++) {
+    region_t& r = regions[n];
+    if (r.first_full > 0)
+      ids.push_back(id(n, 0));
+    for (size_t w = 0; w < r.written.size(); w++) {
+      uint64_t bits = __atomic_exchange_n(&r.written[w], 0, __ATOMIC_RELAXED);
+      for (; bits; bits &= bits - 1) {
+        size_t i = w * 64 + __builtin_ctzll(bits);
+        ids.push_back(id(n, i));
+        protect(r, i, 1, false);
+      }
+    }
+    for (size_t i = r.end_full; i < r.npages; i++)
+      ids.push_back(id(n, i));
+  }
+  return ids;
+}
+
+std::vector<uint64_t> dirty_pages_t::all() const
+{
+  std::vector<uint64_t> ids;
+  for (size_t n = 0; n < regions.size(); n++)
+    for (size_t i = 0; i < regions[n].npages; i++)
+      ids.push_back(id(n, i));
+  return ids;
+}
+
+char* dirty_pages_t::page(uint64_t id, size_t* len) const
+{
+  const region_t& r = regions[id >> 40];
+  char* p = r.base + (id & ((uint64_t(1) << 40) - 1)) * page_size;
+  char* start = std::max(p, r.start);
+  *len = std::min(p + page_size, r.end) - start;
+  return start;
+}
+
+void sim_t::set_checkpoints(uint64_t interval, size_t keep)
+{
+  checkpoint_interval = interval;
+  checkpoint_keep = std::max(keep, size_t(1));
+}
+
+// Called at round boundaries, when no hart is running.
+void sim_t::check_checkpoint()
+{
+  if (checkpoint_interval == 0)
+    return;
+  if (!checkpoints.empty() && executed_steps < checkpoints.back().steps + checkpoint_interval)
+    return;
+
+  checkpoints.emplace_back();
+  checkpoint_t& c = checkpoints.back();
+  c.steps = executed_steps;
+  save_machine_state(&c.machine);
+
+  // The first checkpoint is the base the others are changes to, so it has
+  // every page that is not zero.
+  std::vector<uint64_t> ids;
+  bool first = !dirty_pages;
+  if (first) {
+    std::vector<std::pair<char*, size_t>> regions;
+    for (auto& m : mems)
+      regions.push_back(std::make_pair(m.second->contents(), m.second->size()));
+    dirty_pages.reset(new dirty_pages_t(regions));
+    ids = dirty_pages->all();
+  } else {
+    ids = dirty_pages->collect();
+  }
+
+  for (auto id : ids) {
+    size_t len;
+    const char* p = dirty_pages->page(id, &len);
+    if (first && std::all_of(p, p + len, [](char b) { return b == 0; }))
+      continue;
+    c.pages[id].assign(p, p + len);
+  }
+
+  // Fold the oldest change into the base.
+  if (checkpoints.size() > checkpoint_keep) {
+    checkpoint_t& base = checkpoints[0];
+    checkpoint_t& next = checkpoints[1];
+    for (auto& p : next.pages)
+      base.pages[p.first] = std::move(p.second);
+    base.steps = next.steps;
+    base.machine = std::move(next.machine);
+    checkpoints.erase(checkpoints.begin() + 1);
+  }
+  // Nothing will run from before the oldest one again.
+  while (!host_writes.empty() && host_writes.front().steps < checkpoints[0].steps)
+    host_writes.pop_front();
+}
+
+// At the end of each hart's quantum.  A checkpoint is taken before the
+// host's turn at the same step, so replaying from one writes everything
+// the host wrote at or after it.
+void sim_t::host_turn()
+{
+  if (checkpoints.empty() || executed_steps > host_steps) {
+    host_steps = executed_steps;
+    host->switch_to();
+    return;
+  }
+
+  auto it = std::lower_bound(host_writes.begin(), host_writes.end(), executed_steps,
+    [](const host_write_t& w, uint64_t steps) { return w.steps < steps; });
+  for (; it != host_writes.end() && it->steps == executed_steps; ++it)
+    write_target(it->addr, it->bytes.size(), it->bytes.data());
+}
+
+// Put memory back the way it was at checkpoint i, going back to the newest
+// copy of each page written since, and drop the checkpoints after it.
+void sim_t::restore_checkpoint(size_t i)
+{
+  std::set<uint64_t> written;
+  for (size_t k = i + 1; k < checkpoints.size(); k++)
+    for (auto& p : checkpoints[k].pages)
+      written.insert(p.first);
+  for (auto id : dirty_pages->collect())
+    written.insert(id);
+
+  for (auto id : written) {
+    size_t len;
+    char* p = dirty_pages->page(id, &len);
+    const std::vector<char>* saved = NULL;
+    for (size_t k = i + 1; k-- > 0 && !saved; ) {
+      auto it = checkpoints[k].pages.find(id);
+      if (it != checkpoints[k].pages.end())
+        saved = &it->second;
+    }
+    if (saved)
+      memcpy(p, saved->data(), len);
+    else
+      memset(p, 0, len);
+  }
+  dirty_pages->collect(); // our own stores above
+
+  checkpoints.resize(i + 1);
+  restore_machine_state(checkpoints[i].machine);
+  executed_steps = checkpoints[i].steps;
+}
+
+// Go back to executed_steps == steps, or as near as the oldest checkpoint
+// allows.  Returns whether it got there.
+bool sim_t::reverse_to(uint64_t steps)
+{
+  if (checkpoints.empty())
+    return false;
+  size_t i = checkpoints.size() - 1;
+  while (i > 0 && checkpoints[i].steps > steps)
+    i--;
+  restore_checkpoint(i);
+  if (steps < executed_steps)
+    return false;
+  step(steps - executed_steps);
+  return true;
+}
+
+// Go back to the last step before now at which cond held, or to the oldest
+// checkpoint if it held at none.  The stretch after each checkpoint is run
+// again a step at a time to look for it, newest first.
+bool sim_t::reverse_until(const std::function<bool()>& cond)
+{
+  uint64_t end = executed_steps;
+  for (size_t i = checkpoints.size(); i-- > 0; ) {
+    if (checkpoints[i].steps >= end)
+      continue;
+    restore_checkpoint(i);
+    uint64_t hit = UINT64_MAX;
+    while (executed_steps < end) {
+      if (cond())
+        hit = executed_steps;
+      step(1);
+    }
+    if (hit != UINT64_MAX)
+      return reverse_to(hit);
+    end = checkpoints[i].steps;
+  }
+  if (!checkpoints.empty())
+    restore_checkpoint(0);
+  return false;
+}
@@ -0,0 +1,55 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CHECKPOINT_H
+#define _RISCV_CHECKPOINT_H
+
+// Dirty page tracking for in-memory checkpoints (see checkpoint.cc).  The
+// simulated memories are write-protected; the first store to a page since
+// the last collect() faults, and the fault handler records the page and
+// makes it writable again.  That catches every writer alike: harts through
+// their TLBs, translated code and the host.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+#include <utility>
+#include <vector>
+
+class dirty_pages_t
+{
+public:
+  // Only one may exist at a time: it owns the SIGSEGV and SIGBUS handlers.
+  dirty_pages_t(const std::vector<std::pair<char*, size_t>>& regions);
+  ~dirty_pages_t();
+
+  // Pages written since the last call, which are write-protected again.
+  // Pages at either end of a region that it shares with the host heap
+  // can't be protected, so they are always included.
+  std::vector<uint64_t> collect();
+  // Every page, written or not.
+  std::vector<uint64_t> all() const;
+  // Where a page starts, and how many of its bytes are simulated memory.
+  char* page(uint64_t id, size_t* len) const;
+
+private:
+  struct region_t
+  {
+    char* start;
+    char* end;
+    char* base;               // start rounded down to a host page
+    size_t npages;            // host pages it overlaps
+    size_t first_full;        // [first_full, end_full) lie wholly inside it
+    size_t end_full;
+    std::vector<uint64_t> written; // a bit per page, set by the handler
+  };
+
+  std::vector<region_t> regions;
+  size_t page_size;
+
+  static uint64_t id(size_t region, size_t page) { return uint64_t(region) << 40 | page; }
+  void protect(const region_t& r, size_t first, size_t n, bool writable);
+  bool mark(char* addr);
+  static void handle_fault(int sig, siginfo_t* info, void* context);
+};
+
+#endif
@@ -0,0 +1,91 @@
+// See LICENSE for license details.
+
+#include "commit_log.h"
+#include "decode.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef RISCV_ENABLE_COMMITLOG
+thread_local commit_log_mem_t commit_log_mem;
+#endif
+
+commit_log_t::commit_log_t(const char* path)
+  : head(0), tail(0), done(false), writer_asleep(false), ring(RING_RECORDS)
+{
+  out = fopen(path, "wb");
+  if (!out) {
+    perror(path);
+    exit(1);
+  }
+
+  commit_log_header_t h;
+  memcpy(h.magic, COMMIT_LOG_MAGIC, sizeof(h.magic));
+  h.record_size = sizeof(commit_log_record_t);
+  h.reserved = 0;
+  fwrite(&h, sizeof(h), 1, out);
+
+  writer = std::thread(&commit_log_t::write_records, this);
+}
+
+commit_log_t::~commit_log_t()
+{
+  done.store(true, std::memory_order_release);
+  wake_writer();
+  writer.join();
+  fclose(out);
+}
+
+void commit_log_t::write_records()
+{
+  while (true) {
+    // Read done before head, so a record pushed before done was set is
+    // still seen below.
+    bool last = done.load(std::memory_order_acquire);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t t = tail.load(std::memory_order_relaxed);
+
+    if (h == t) {
+      if (last)
+        break;
+      wait_for_records(t);
+      continue;
+    }
+
+    // Up to the end of the ring; the rest goes on the next pass.
+    size_t n = std::min(h - t, RING_RECORDS - t % RING_RECORDS);
+    fwrite(&ring[t % RING_RECORDS], sizeof(commit_log_record_t), n, out);
+    tail.store(t + n, std::memory_order_release);
+
+    std::lock_guard<std::mutex> guard(lock);
+    drained.notify_one();
+  }
+}
+
+// Until push() has a batch for us or the log is being closed.  Records
+// pushed since the last batch wait in the ring until then.
+void commit_log_t::wait_for_records(size_t t)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  writer_asleep.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (head.load(std::memory_order_relaxed) - t < WAKE_RECORDS &&
+      !done.load(std::memory_order_relaxed))
+    pushed.wait(guard);
+  writer_asleep.store(false, std::memory_order_relaxed);
+}
+
+void commit_log_t::wake_writer()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  pushed.notify_one();
+}
+
+void commit_log_t::wait_for_room(size_t h)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  pushed.notify_one();
+  drained.wait(guard, [&] {
+    return h - tail.load(std::memory_order_acquire) < RING_RECORDS;
+  });
+}
@@ -0,0 +1,101 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_COMMIT_LOG_H
+#define _RISCV_COMMIT_LOG_H
+
+// Binary commit log.  With RISCV_ENABLE_COMMITLOG and a log file set (see
+// sim_t::set_commit_log), the block loop writes one fixed-size record per
+// retired instruction instead of the text processor_t::step prints.  The
+// simulator thread only copies records into a ring; a writer thread drains
+// it to the file, sleeping while there is nothing to drain.  lisc-commitlog
+// turns a log back into the text format.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define COMMIT_LOG_MAGIC "LISCCLOG"
+
+struct commit_log_header_t
+{
+  char magic[8];            // COMMIT_LOG_MAGIC
+  uint32_t record_size;     // sizeof(commit_log_record_t)
+  uint32_t reserved;
+};
+
+struct commit_log_record_t
+{
+  uint64_t pc;
+  uint64_t insn;            // instruction bits, masked to its length
+  uint64_t wdata;           // value written to reg, if any
+  uint64_t mem_addr;        // memory access, if mem_size != 0
+  uint64_t mem_data;
+  uint8_t prv;              // privilege the instruction ran at
+  uint8_t reg;              // log_reg_write.addr: reg << 1 | is_fp, or 0
+  uint8_t mem_size;         // bytes accessed, or 0
+  uint8_t mem_store;        // mem_data was stored rather than loaded
+  uint32_t reserved;
+};
+
+// Single-producer, single-consumer ring of records and the thread that
+// writes them out.
+class commit_log_t
+{
+public:
+  static const size_t RING_RECORDS = 1 << 16;
+  // A sleeping writer is woken once this many records are waiting, so the
+  // simulator only pays for the check once a batch.
+  static const size_t WAKE_RECORDS = RING_RECORDS / 16;
+
+  // Exits the simulator if path cannot be opened for writing.
+  commit_log_t(const char* path);
+  // Writes everything still in the ring.
+  ~commit_log_t();
+
+  // Called by the simulator thread only.  Waits for the writer if the ring
+  // is full, so no record is dropped.
+  inline void push(const commit_log_record_t& r)
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == RING_RECORDS)
+      wait_for_room(h);
+    ring[h % RING_RECORDS] = r;
+    head.store(h + 1, std::memory_order_release);
+
+    if ((h + 1) % WAKE_RECORDS == 0) {
+      // Pairs with the fence in wait_for_records(): either the writer
+      // sees this record before it sleeps, or we see that it is asleep.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (writer_asleep.load(std::memory_order_relaxed))
+        wake_writer();
+    }
+  }
+
+private:
+  // head and tail are written by different threads, so keep them on
+  // different cache lines.
+  std::atomic<size_t> head;   // next record the simulator writes
+  char head_pad[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail;   // next record the writer reads
+  char tail_pad[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<bool> done;
+  std::atomic<bool> writer_asleep;
+  std::mutex lock;
+  std::condition_variable pushed;   // the writer waits here for records
+  std::condition_variable drained;  // and the simulator for room
+
+  std::vector<commit_log_record_t> ring;
+  FILE* out;
+  std::thread writer;
+
+  void write_records();
+  void wait_for_records(size_t t);
+  void wake_writer();
+  void wait_for_room(size_t h);
+};
+
+#endif
@@ -19,6 +19,7 @@
 #include "common.h"
 #include "softfloat_types.h"
 #include "specialize.h"
+#include "insn_format.h"
 #include <cinttypes>
 #include <stdio.h>
 
@@ -73,32 +74,45 @@ const int NCSR = 4096;
 #define PC_ALIGN 2
 
 typedef uint64_t insn_bits_t;
+
+// insn_t is built once per fetched instruction word (when the icache entry is
+// refilled), so the register indices and the sign-extended immediate are
+// extracted here rather than on every execution of the handler.  LISC keeps
+// the major opcode in the low byte, which is enough to pick the immediate
+// format.  Field positions come from insn_format.h.
 class insn_t
 {
 public:
+  // Operands known at compile time; see insn_variant_t.
+  static const bool rd_zero = false, rd_nonzero = false;
+  static const bool rs1_zero = false, rs2_zero = false;
+
   insn_t() = default;
-  insn_t(insn_bits_t bits) : b(bits) {}
+  insn_t(insn_bits_t bits)
+    : b(bits), imm(decode_imm(bits)),
+      rd_(insn_rd_field_t::extract(bits)), rs1_(insn_rs1_field_t::extract(bits)),
+      rs2_(insn_rs2_field_t::extract(bits)) {}
   insn_bits_t bits() { return b; }
   int length() { return insn_length(b); }
   //根据立即数位域不同对其进行修改
-  int64_t i_imm() { /*printf("%x %d\n",b,xs(12,12));*/ return xs(12, 12); }  //类似于add的指令使用
-  int64_t s_imm() { return x(12, 8) + (xs(8, 4) << 8); } //类似于store指令使用
-  int64_t sb_imm() { return (x(13, 7) + (x(8, 4) << 7) + ( xs(12,1) << 11))<<1; } //类似与branch或者beq指令使用
+  int64_t i_imm() { return imm; }  //类似于add的指令使用
+  int64_t s_imm() { return imm; } //类似于store指令使用
+  int64_t sb_imm() { return imm; } //类似与branch或者beq指令使用
    //由于偏移量的定义不同，因此根据lisc重新获得立即数，但是为了保证使用u_imm的都可以，还是保留原定义
-  int64_t u_imm() { return int64_t(b) >> 12 << 12; } //类似于 AUIPC和LIU指令使用 
+  int64_t u_imm() { return imm; } //类似于 AUIPC和LIU指令使用 
 //  int64_t ij_imm() { return x(13,7) + (xs(12,1) << 11) ; } //类似于JALR等跳转指令使用
-  int64_t uj_imm() { return ((x(13, 15)) + (x(8, 4) << 15) + ( xs(12,1) << 19 ))<<1; } //类似于JAL等跳转指令使用
+  int64_t uj_imm() { return imm; } //类似于JAL等跳转指令使用
 
-  uint64_t zimm() { return x(24,5); }
-  uint64_t shamt() { return x(16,8); }
+  uint64_t zimm() { return insn_zimm_field_t::extract(b); }
+  uint64_t shamt() { return insn_shamt_field_t::extract(b); }
 
   //根据寄存器位域的不同，对其进行修改
-  uint64_t rd() { return x(8, 4); }
-  uint64_t rs1() { return x(24, 4); }
-  uint64_t rs2() { return x(20, 4); }
-  uint64_t rs3() { return x(16, 4); }
-  uint64_t rm() { return x(12, 3); }
-  uint64_t csr() { return x(12, 12); }
+  uint64_t rd() { return rd_; }
+  uint64_t rs1() { return rs1_; }
+  uint64_t rs2() { return rs2_; }
+  uint64_t rs3() { return insn_rs3_field_t::extract(b); }
+  uint64_t rm() { return insn_rm_field_t::extract(b); }
+  uint64_t csr() { return insn_csr_field_t::extract(b); }
 
   // 压缩指令相关内容，暂时不做修改
   int64_t rvc_imm() { return x(2, 5) + (xs(12, 1) << 5); }
@@ -121,41 +135,122 @@ public:
   uint64_t rvc_rs2s() { return 8 + x(2, 3); }
 private:
   insn_bits_t b;
-  uint64_t x(int lo, int len) { return (b >> lo) & ((insn_bits_t(1) << len)-1); }
-  uint64_t xs(int lo, int len) { return int64_t(b) << (64-lo-len) >> (64-len); }
+  int32_t imm;
+  uint8_t rd_, rs1_, rs2_;
+  uint64_t x(int lo, int len) { return field(b, lo, len); }
+  uint64_t xs(int lo, int len) { return sfield(b, lo, len); }
   uint64_t imm_sign() { return xs(63, 1); }
+
+  static uint64_t field(insn_bits_t b, int lo, int len) { return (b >> lo) & ((insn_bits_t(1) << len)-1); }
+  static uint64_t sfield(insn_bits_t b, int lo, int len) { return int64_t(b) << (64-lo-len) >> (64-len); }
+
+  static int64_t decode_imm(insn_bits_t b)
+  {
+    switch (b & 0xff) {
+      case MATCH_SB:
+      case MATCH_SH:
+      case MATCH_SW:
+        return insn_s_imm_field_t::extract(b);
+      case MATCH_BEQ:
+      case MATCH_BNE:
+      case MATCH_BLT:
+      case MATCH_BGE:
+      case MATCH_BLTU:
+      case MATCH_BGEU:
+        return insn_sb_imm_field_t::extract(b);
+      case MATCH_LUI:
+      case MATCH_AUIPC:
+        return insn_u_imm_field_t::extract(b);
+      case MATCH_J:
+        return insn_uj_imm_field_t::extract(b);
+      default:
+        return insn_i_imm_field_t::extract(b);
+    }
+  }
 };
 
+// With zero_reg, register 0 reads as zero and writes to it go to a sink
+// slot past the end, so write() needs no branch.  Such a register file is
+// the hart's integer registers, the state every instruction touches, so it
+// starts on its own cache line.
+#define REGFILE_ALIGN 64
+
 template <class T, size_t N, bool zero_reg>
 class regfile_t
 {
 public:
   void write(size_t i, T value)
   {
-    if (!zero_reg || i != 0)
-      data[i] = value;
+    data[zero_reg && i == 0 ? N : i] = value;
+  }
+  // For an index already known not to be the zero register.
+  void write_nonzero(size_t i, T value)
+  {
+    data[i] = value;
   }
   const T& operator [] (size_t i) const
   {
     return data[i];
   }
+  // For translated code, which must leave data[0] alone itself.
+  T* raw() { return data; }
 private:
-  T data[N];
+  alignas(zero_reg ? REGFILE_ALIGN : alignof(T)) T data[N + zero_reg];
 };
 
+// LISC32 builds (configured with CPPFLAGS=-DLISC32) run only 32-bit harts,
+// so the integer registers are kept in 32 bits.  A read sign-extends, giving
+// the value sext_xlen() would have stored, and a write just truncates.
+// x0 through x15, all that most LISC instructions can name, then share one
+// cache line.
+#ifdef LISC32
+typedef int32_t xreg_storage_t;
+
+template <size_t N, bool zero_reg>
+class regfile_t<reg_t, N, zero_reg>
+{
+public:
+  void write(size_t i, reg_t value)
+  {
+    data[zero_reg && i == 0 ? N : i] = value;
+  }
+  void write_nonzero(size_t i, reg_t value)
+  {
+    data[i] = value;
+  }
+  reg_t operator [] (size_t i) const
+  {
+    return sreg_t(data[i]);
+  }
+  xreg_storage_t* raw() { return data; }
+private:
+  alignas(zero_reg ? REGFILE_ALIGN : alignof(xreg_storage_t)) xreg_storage_t data[N + zero_reg];
+};
+#else
+typedef reg_t xreg_storage_t;
+#endif
+
 // helpful macros, etc
 #define MMU (*p->get_mmu())
 #define STATE (*p->get_state())
 #define READ_REG(reg) STATE.XPR[reg]
 #define READ_FREG(reg) STATE.FPR[reg]
-#define RS1 READ_REG(insn.rs1())
-#define RS2 READ_REG(insn.rs2())
-#define WRITE_RD(value) WRITE_REG(insn.rd(), value)
+#define RS1 (insn.rs1_zero ? reg_t(0) : READ_REG(insn.rs1()))
+#define RS2 (insn.rs2_zero ? reg_t(0) : READ_REG(insn.rs2()))
 
 #ifndef RISCV_ENABLE_COMMITLOG
+# define WRITE_RD(value) ({ \
+    reg_t wdata = (value); /* evaluated even for x0; it may trap */ \
+    if (insn.rd_nonzero) \
+      STATE.XPR.write_nonzero(insn.rd(), wdata); \
+    else if (!insn.rd_zero) \
+      STATE.XPR.write(insn.rd(), wdata); \
+  })
 # define WRITE_REG(reg, value) STATE.XPR.write(reg, value)
 # define WRITE_FREG(reg, value) DO_WRITE_FREG(reg, freg(value))
+# define LOG_MEM(addr, data, size, store) ((void)0)
 #else
+# define WRITE_RD(value) WRITE_REG(insn.rd(), value)
 # define WRITE_REG(reg, value) ({ \
     reg_t wdata = (value); /* value may have side effects */ \
     STATE.log_reg_write = (commit_log_reg_t){(reg) << 1, {wdata, 0}}; \
@@ -166,6 +261,12 @@ private:
     STATE.log_reg_write = (commit_log_reg_t){((reg) << 1) | 1, wdata}; \
     DO_WRITE_FREG(reg, wdata); \
   })
+// The memory access of the instruction being run, for the binary commit
+// log (commit_log.h).  Like log_reg_write, the loop that logs clears it.
+struct commit_log_mem_t { reg_t addr; reg_t data; uint8_t size; bool store; };
+extern thread_local commit_log_mem_t commit_log_mem;
+# define LOG_MEM(addr, data, size, store) \
+    (commit_log_mem = (commit_log_mem_t){(addr), (data), (size), (store)})
 #endif
 
 // RVC macros
@@ -194,13 +295,17 @@ private:
 #define JUMP_TARGET ( ( pc + insn.uj_imm() ) )
 #define RM ({ int rm = insn.rm(); \
               if(rm == 7) rm = STATE.frm; \
-              if(rm > 4) throw trap_illegal_instruction(0); \
+              if(rm > 4) raise_illegal_insn(); \
               rm; })
 
 #define get_field(reg, mask) (((reg) & (decltype(reg))(mask)) / ((mask) & ~((mask) << 1)))
 #define set_field(reg, mask, val) (((reg) & ~(decltype(reg))(mask)) | (((decltype(reg))(val) * ((mask) & ~((mask) << 1))) & (decltype(reg))(mask)))
 
-#define require(x) if (unlikely(!(x))) throw trap_illegal_instruction(0)
+// Handlers raise illegal-instruction traps through raise_illegal_insn().
+// The shaped variants the block loop runs redefine it to return
+// PC_ILLEGAL_INSN instead of throwing (see insn_variant_template.cc).
+#define raise_illegal_insn() throw trap_illegal_instruction(0)
+#define require(x) if (unlikely(!(x))) raise_illegal_insn()
 #define require_privilege(p) require(STATE.prv >= (p))
 #define require_rv64 require(xlen == 64)
 #define require_rv32 require(xlen == 32)
@@ -216,8 +321,13 @@ private:
 
 #define sext32(x) ((sreg_t)(int32_t)(x))
 #define zext32(x) ((reg_t)(uint32_t)(x))
-#define sext_xlen(x) (((sreg_t)(x) << (64-xlen)) >> (64-xlen))
-#define zext_xlen(x) (((reg_t)(x) << (64-xlen)) >> (64-xlen))
+#ifdef LISC32
+# define sext_xlen(x) sext32(x)
+# define zext_xlen(x) zext32(x)
+#else
+# define sext_xlen(x) (((sreg_t)(x) << (64-xlen)) >> (64-xlen))
+# define zext_xlen(x) (((reg_t)(x) << (64-xlen)) >> (64-xlen))
+#endif
 
 #define set_pc(x) \
   do { p->check_pc_alignment(x); \
@@ -232,9 +342,37 @@ private:
 
 #define serialize() set_pc_and_serialize(npc)
 
+// Code lines that hold cached basic blocks.  Every store goes through
+// mmu_t's store_func, which calls code_line_store.  A store into a marked
+// line clears that line's bit, logs it in code_line_writes and bumps
+// code_generation; each block cache then drops just the blocks on that line
+// (or any line that aliases it in the map) and re-marks the ones it
+// rebuilds.  Harts on the hart pool share all three, so they are updated
+// atomically.
+#define CODE_LINE_SHIFT 6
+#define CODE_MAP_BITS 21
+#define CODE_WRITE_LOG 256
+extern uint64_t code_line_map[];
+extern uint64_t code_line_writes[];
+extern volatile uint64_t code_generation;
+void mark_code_lines(reg_t start, reg_t end);
+void code_line_written(reg_t idx);
+void code_lines_reset();
+
+inline bool code_line_store(reg_t addr)
+{
+  reg_t idx = (addr >> CODE_LINE_SHIFT) & ((1 << CODE_MAP_BITS) - 1);
+  if (likely(!((code_line_map[idx / 64] >> (idx % 64)) & 1)))
+    return false;
+  code_line_written(idx);
+  return true;
+}
+
 /* Sentinel PC values to serialize simulator pipeline */
 #define PC_SERIALIZE_BEFORE 3
 #define PC_SERIALIZE_AFTER 5
+/* The instruction is illegal; take trap_illegal_instruction(0) at its pc */
+#define PC_ILLEGAL_INSN 7
 #define invalid_pc(pc) ((pc) & 1)
 
 /* Convenience wrappers to simplify softfloat code sequences */
@@ -283,7 +421,7 @@ inline freg_t f128_negate(freg_t a)
   unsigned csr_priv = get_field((which), 0x300); \
   unsigned csr_read_only = get_field((which), 0xC00) == 3; \
   if (((write) && csr_read_only) || STATE.prv < csr_priv) \
-    throw trap_illegal_instruction(0); \
+    raise_illegal_insn(); \
   (which); })
 
 // Seems that 0x0 doesn't work.
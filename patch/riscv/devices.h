@@ -0,0 +1,88 @@
+#ifndef _RISCV_DEVICES_H
+#define _RISCV_DEVICES_H
+
+#include "decode.h"
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <map>
+#include <vector>
+
+class processor_t;
+
+class abstract_device_t {
+ public:
+  virtual bool load(reg_t addr, size_t len, uint8_t* bytes) = 0;
+  virtual bool store(reg_t addr, size_t len, const uint8_t* bytes) = 0;
+  virtual ~abstract_device_t() {}
+};
+
+class bus_t : public abstract_device_t {
+ public:
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  void add_device(reg_t addr, abstract_device_t* dev);
+
+  std::pair<reg_t, abstract_device_t*> find_device(reg_t addr);
+
+ private:
+  std::map<reg_t, abstract_device_t*> devices;
+};
+
+class rom_device_t : public abstract_device_t {
+ public:
+  rom_device_t(std::vector<char> data);
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+ private:
+  std::vector<char> data;
+};
+
+// Target memory is a reservation of anonymous pages (see mem.cc), so it
+// costs nothing until it is touched and reads as zero until then.
+class mem_t : public abstract_device_t {
+ public:
+  mem_t(size_t size);
+  mem_t(const mem_t& that) = delete;
+  ~mem_t();
+
+  bool load(reg_t addr, size_t len, uint8_t* bytes) { return false; }
+  bool store(reg_t addr, size_t len, const uint8_t* bytes) { return false; }
+  char* contents() { return data; }
+  size_t size() { return len; }
+  // Zero [start, start + n), handing whole pages back to the host.
+  void zero(size_t start, size_t n);
+  // Map n bytes of a file at offset file_off over [start, start + n),
+  // copy-on-write.  Both offsets and n must be multiples of the host page.
+  bool map_file(size_t start, size_t n, int fd, uint64_t file_off);
+
+ private:
+  char* data;
+  size_t len;
+  size_t mapped; // len rounded up to a host page
+  bool file_backed; // some pages come from map_file()
+  bool drop(size_t start, size_t n);
+};
+
+class clint_t : public abstract_device_t {
+ public:
+  clint_t(std::vector<processor_t*>&);
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  size_t size() { return CLINT_SIZE; }
+  void increment(reg_t inc);
+  // Hart i's MSIP and MTIP bits, for it to copy into its mip.
+  reg_t mip(size_t i) const { return ip[i].load(std::memory_order_acquire); }
+ private:
+  typedef uint64_t mtime_t;
+  typedef uint64_t mtimecmp_t;
+  typedef uint32_t msip_t;
+  std::vector<processor_t*>& procs;
+  mtime_t mtime;
+  std::vector<mtimecmp_t> mtimecmp;
+  // Kept here rather than in the harts' mip: a hart may be running on
+  // another thread (see sim_t::sync_mip).
+  std::vector<std::atomic<reg_t>> ip;
+};
+
+#endif
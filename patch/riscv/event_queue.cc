@@ -0,0 +1,47 @@
+// See LICENSE for license details.
+
+#include "event_queue.h"
+#include <algorithm>
+
+void event_queue_t::drop_cancelled()
+{
+  while (!queue.empty() && !pending.count(queue.top().id))
+    queue.pop();
+}
+
+uint64_t event_queue_t::next_deadline()
+{
+  drop_cancelled();
+  return queue.empty() ? UINT64_MAX : std::max(queue.top().when, time);
+}
+
+event_id_t event_queue_t::schedule(uint64_t when, std::function<void()> callback)
+{
+  event_t e = {when, ++last_id, callback};
+  queue.push(e);
+  pending.insert(e.id);
+  return e.id;
+}
+
+void event_queue_t::advance(uint64_t when)
+{
+  while (true) {
+    drop_cancelled();
+    if (queue.empty() || queue.top().when > when)
+      break;
+
+    event_t e = queue.top();
+    queue.pop();
+    pending.erase(e.id);
+    time = std::max(time, e.when);
+    e.callback();
+  }
+  time = std::max(time, when);
+}
+
+void event_queue_t::reset(uint64_t when)
+{
+  queue = decltype(queue)();
+  pending.clear();
+  time = when;
+}
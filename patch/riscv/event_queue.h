@@ -0,0 +1,63 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_EVENT_QUEUE_H
+#define _RISCV_EVENT_QUEUE_H
+
+// Simulated-time events.  Time is counted in steps, the instructions each
+// hart runs per round (see sim_t::step), so a CLINT tick is
+// INSNS_PER_RTC_TICK of them.  Devices schedule a callback for a point in
+// simulated time; the scheduler ends rounds no later than the earliest one
+// and runs it then, so nothing has to be polled in between.
+
+#include <stdint.h>
+#include <functional>
+#include <queue>
+#include <unordered_set>
+#include <vector>
+
+typedef uint64_t event_id_t; // 0 is never a valid id
+
+class event_queue_t
+{
+public:
+  event_queue_t() : time(0), last_id(0) {}
+
+  uint64_t now() const { return time; }
+  // Earliest pending deadline, or UINT64_MAX if there is none.
+  uint64_t next_deadline();
+
+  // Deadlines in the past run at the next advance().
+  event_id_t schedule(uint64_t when, std::function<void()> callback);
+  // Fine to call for an event that has already run.
+  void cancel(event_id_t id) { pending.erase(id); }
+
+  // Drop every event and start again at time; whoever scheduled them must
+  // do so again.
+  void reset(uint64_t time);
+
+  // Run every event due by when, in deadline order and with now() set to
+  // its deadline, then set now() to when.  Events may schedule more.
+  void advance(uint64_t when);
+
+private:
+  struct event_t
+  {
+    uint64_t when;
+    event_id_t id;            // ties go in scheduling order
+    std::function<void()> callback;
+
+    bool operator>(const event_t& e) const
+    {
+      return when != e.when ? when > e.when : id > e.id;
+    }
+  };
+
+  std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t>> queue;
+  std::unordered_set<event_id_t> pending; // scheduled and not cancelled
+  uint64_t time;
+  event_id_t last_id;
+
+  void drop_cancelled();
+};
+
+#endif
@@ -0,0 +1,122 @@
+// See LICENSE for license details.
+
+// CSR instructions normally serialize: validate_csr() sends the hart out
+// of its loop to run them on their own, and serialize() sends it out again
+// afterwards.  That is needed when the access changes privilege,
+// translation or interrupt state, and when it reads the retired-instruction
+// count the loop has not added to minstret yet.  Accesses that do neither
+// get the handlers below in cached blocks instead.  They make the same
+// get_csr()/set_csr() calls and privilege checks, so they raise the same
+// traps.
+
+#include "block_cache.h"
+#include "insn_decode.h"
+#include "processor.h"
+
+// As in the shaped variants, the block loop takes the trap.
+#undef raise_illegal_insn
+#define raise_illegal_insn() return PC_ILLEGAL_INSN
+
+static bool in_range(int csr, int lo, int hi)
+{
+  return csr >= lo && csr <= hi;
+}
+
+bool csr_reads_counter(int csr)
+{
+  switch (csr) {
+    case CSR_CYCLE:
+    case CSR_TIME:
+    case CSR_INSTRET:
+    case CSR_CYCLEH:
+    case CSR_TIMEH:
+    case CSR_INSTRETH:
+    case CSR_MCYCLE:
+    case CSR_MINSTRET:
+    case CSR_MCYCLEH:
+    case CSR_MINSTRETH:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool csr_is_side_effect_free(int csr, bool write)
+{
+  // Scratch registers are plain storage.
+  if (csr == CSR_MSCRATCH || csr == CSR_SSCRATCH)
+    return true;
+  if (write)
+    return false;
+
+  switch (csr) {
+    case CSR_MVENDORID:
+    case CSR_MARCHID:
+    case CSR_MIMPID:
+    case CSR_MHARTID:
+      return true;
+    default:
+      return csr_reads_counter(csr) ||
+             in_range(csr, CSR_HPMCOUNTER3, CSR_HPMCOUNTER31) ||
+             in_range(csr, CSR_HPMCOUNTER3H, CSR_HPMCOUNTER31H) ||
+             in_range(csr, CSR_MHPMCOUNTER3, CSR_MHPMCOUNTER31) ||
+             in_range(csr, CSR_MHPMCOUNTER3H, CSR_MHPMCOUNTER31H);
+  }
+}
+
+// insns/csrr*.h without the serialization.
+template<int xlen, insn_index_t op>
+static reg_t fast_csr(processor_t* p, insn_t insn, reg_t pc)
+{
+  reg_t npc = sext_xlen(pc + insn_length(insn.bits()));
+  bool imm = op == INSN_csrrwi || op == INSN_csrrsi || op == INSN_csrrci;
+  reg_t src = imm ? reg_t(insn.zimm()) : RS1;
+  bool write = op == INSN_csrrw || op == INSN_csrrwi ||
+               (imm ? insn.zimm() : insn.rs1()) != 0;
+
+  int csr = insn.csr();
+  unsigned csr_priv = get_field(csr, 0x300);
+  unsigned csr_read_only = get_field(csr, 0xC00) == 3;
+  if ((write && csr_read_only) || STATE.prv < csr_priv)
+    raise_illegal_insn();
+
+  reg_t old = p->get_csr(csr);
+  if (write) {
+    switch (op) {
+      case INSN_csrrw: case INSN_csrrwi: p->set_csr(csr, src); break;
+      case INSN_csrrs: case INSN_csrrsi: p->set_csr(csr, old | src); break;
+      default: p->set_csr(csr, old & ~src); break;
+    }
+  }
+  WRITE_RD(sext_xlen(old));
+  return npc;
+}
+
+template<int xlen>
+static insn_func_t find(insn_index_t index)
+{
+  switch (index) {
+    case INSN_csrrw: return fast_csr<xlen, INSN_csrrw>;
+    case INSN_csrrs: return fast_csr<xlen, INSN_csrrs>;
+    case INSN_csrrc: return fast_csr<xlen, INSN_csrrc>;
+    case INSN_csrrwi: return fast_csr<xlen, INSN_csrrwi>;
+    case INSN_csrrsi: return fast_csr<xlen, INSN_csrrsi>;
+    case INSN_csrrci: return fast_csr<xlen, INSN_csrrci>;
+    default: return NULL;
+  }
+}
+
+insn_func_t find_fast_csr(insn_t insn, unsigned xlen)
+{
+  insn_index_t index = insn_decode(insn.bits());
+  bool imm = index == INSN_csrrwi || index == INSN_csrrsi || index == INSN_csrrci;
+  bool write = index == INSN_csrrw || index == INSN_csrrwi ||
+               (imm ? insn.zimm() : insn.rs1()) != 0;
+  if (!csr_is_side_effect_free(insn.csr(), write))
+    return NULL;
+#ifdef LISC32
+  return find<32>(index);
+#else
+  return xlen == 32 ? find<32>(index) : find<64>(index);
+#endif
+}
@@ -0,0 +1,191 @@
+// See LICENSE for license details.
+
+#include "fdt.h"
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_VERSION 17
+#define FDT_LAST_COMP_VERSION 16
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_END 9
+
+fdt_node_t* fdt_node_t::add_node(const std::string& name, const std::string& label)
+{
+  children.emplace_back(new fdt_node_t(name, label));
+  return children.back().get();
+}
+
+void fdt_node_t::add_cells(const std::string& prop, const std::vector<fdt_cell_t>& cells)
+{
+  props.push_back({prop, cells, {}});
+}
+
+void fdt_node_t::add_strings(const std::string& prop, const std::vector<std::string>& strings)
+{
+  props.push_back({prop, {}, strings});
+}
+
+class fdt_writer_t
+{
+public:
+  fdt_writer_t(const fdt_node_t* root)
+  {
+    find_references(root);
+  }
+
+  std::string dts(const fdt_node_t* root)
+  {
+    std::ostringstream s;
+    s << "/dts-v1/;\n\n";
+    write_source(s, root, 0);
+    return s.str();
+  }
+
+  std::string dtb(const fdt_node_t* root)
+  {
+    write_struct(root);
+    put_u32(structure, FDT_END);
+
+    const uint32_t header_size = 40, rsvmap_size = 16;
+    uint32_t off_struct = header_size + rsvmap_size;
+    uint32_t off_strings = off_struct + structure.size();
+    std::string blob;
+    put_u32(blob, FDT_MAGIC);
+    put_u32(blob, off_strings + strings.size());  // totalsize
+    put_u32(blob, off_struct);
+    put_u32(blob, off_strings);
+    put_u32(blob, header_size);                   // off_mem_rsvmap
+    put_u32(blob, FDT_VERSION);
+    put_u32(blob, FDT_LAST_COMP_VERSION);
+    put_u32(blob, 0);                             // boot_cpuid_phys
+    put_u32(blob, strings.size());
+    put_u32(blob, structure.size());
+    blob.append(rsvmap_size, '\0');               // just the terminator
+    return blob + structure + strings;
+  }
+
+private:
+  std::map<std::string, uint32_t> phandles;     // referenced labels
+  std::map<std::string, uint32_t> string_offsets;
+  std::string structure;
+  std::string strings;
+
+  void find_references(const fdt_node_t* n)
+  {
+    for (auto& p : n->props)
+      for (auto& c : p.cells)
+        if (!c.label.empty() && !phandles.count(c.label)) {
+          uint32_t next = phandles.size() + 1;
+          phandles[c.label] = next;
+        }
+    for (auto& c : n->children)
+      find_references(c.get());
+  }
+
+  uint32_t phandle(const std::string& label)
+  {
+    auto it = phandles.find(label);
+    if (it == phandles.end())
+      throw std::logic_error("device tree refers to unknown label " + label);
+    return it->second;
+  }
+
+  static void put_u32(std::string& s, uint32_t x)
+  {
+    char b[4] = {char(x >> 24), char(x >> 16), char(x >> 8), char(x)};
+    s.append(b, 4);
+  }
+
+  static void pad(std::string& s)
+  {
+    s.append((4 - s.size() % 4) % 4, '\0');
+  }
+
+  uint32_t string_offset(const std::string& name)
+  {
+    auto it = string_offsets.find(name);
+    if (it != string_offsets.end())
+      return it->second;
+    uint32_t off = strings.size();
+    strings.append(name.c_str(), name.size() + 1);
+    string_offsets[name] = off;
+    return off;
+  }
+
+  void write_struct(const fdt_node_t* n)
+  {
+    put_u32(structure, FDT_BEGIN_NODE);
+    structure.append(n->name.c_str(), n->name.size() + 1);
+    pad(structure);
+
+    std::vector<fdt_node_t::prop_t> props = n->props;
+    if (!n->label.empty() && phandles.count(n->label))
+      props.push_back({"phandle", {phandle(n->label)}, {}});
+
+    for (auto& p : props) {
+      std::string value;
+      for (auto& c : p.cells)
+        put_u32(value, c.label.empty() ? c.value : phandle(c.label));
+      for (auto& str : p.strings)
+        value.append(str.c_str(), str.size() + 1);
+
+      put_u32(structure, FDT_PROP);
+      put_u32(structure, value.size());
+      put_u32(structure, string_offset(p.name));
+      structure += value;
+      pad(structure);
+    }
+
+    for (auto& c : n->children)
+      write_struct(c.get());
+    put_u32(structure, FDT_END_NODE);
+  }
+
+  void write_source(std::ostringstream& s, const fdt_node_t* n, int depth)
+  {
+    std::string indent(depth * 2, ' ');
+    s << indent;
+    if (!n->label.empty())
+      s << n->label << ": ";
+    s << (depth == 0 ? "/" : n->name) << " {\n";
+
+    for (auto& p : n->props) {
+      s << indent << "  " << p.name;
+      if (!p.cells.empty()) {
+        s << " = <";
+        for (size_t i = 0; i < p.cells.size(); i++) {
+          const fdt_cell_t& c = p.cells[i];
+          s << (i ? " " : "");
+          if (c.label.empty())
+            s << "0x" << std::hex << c.value << std::dec;
+          else
+            s << "&" << c.label;
+        }
+        s << ">";
+      } else if (!p.strings.empty()) {
+        s << " = ";
+        for (size_t i = 0; i < p.strings.size(); i++)
+          s << (i ? ", " : "") << "\"" << p.strings[i] << "\"";
+      }
+      s << ";\n";
+    }
+
+    for (auto& c : n->children)
+      write_source(s, c.get(), depth + 1);
+    s << indent << "};\n";
+  }
+};
+
+std::string fdt_node_t::dts() const
+{
+  return fdt_writer_t(this).dts(this);
+}
+
+std::string fdt_node_t::dtb() const
+{
+  return fdt_writer_t(this).dtb(this);
+}
@@ -0,0 +1,57 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_FDT_H
+#define _RISCV_FDT_H
+
+// A device tree built in memory.  It is written out as source for
+// get_dts(), or as a flattened blob (version 17) for the boot ROM, so making
+// the DTB needs no dtc.
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One cell of a property: a number, or a reference to a labelled node,
+// which becomes that node's phandle.
+struct fdt_cell_t
+{
+  fdt_cell_t(uint32_t value) : value(value) {}
+  fdt_cell_t(const std::string& label) : value(0), label(label) {}
+
+  uint32_t value;
+  std::string label;
+};
+
+class fdt_node_t
+{
+public:
+  fdt_node_t(const std::string& name, const std::string& label = "")
+    : name(name), label(label) {}
+
+  fdt_node_t* add_node(const std::string& name, const std::string& label = "");
+  void add_cells(const std::string& prop, const std::vector<fdt_cell_t>& cells);
+  void add_strings(const std::string& prop, const std::vector<std::string>& strings);
+  void add_empty(const std::string& prop) { add_strings(prop, {}); }
+
+  // Only meaningful on the root node.
+  std::string dts() const;
+  std::string dtb() const;
+
+private:
+  struct prop_t
+  {
+    std::string name;
+    std::vector<fdt_cell_t> cells;    // either cells,
+    std::vector<std::string> strings; // or strings, or neither
+  };
+
+  std::string name;
+  std::string label;
+  std::vector<prop_t> props;
+  std::vector<std::unique_ptr<fdt_node_t>> children;
+
+  friend class fdt_writer_t;
+};
+
+#endif
@@ -0,0 +1,151 @@
+// See LICENSE for license details.
+
+// Fused handlers for instruction pairs the toolchain emits back to back.
+// Each one has the same architectural effect as running insns/*.h for both
+// instructions in turn, so only the dispatch between them is saved.  None
+// of the first instructions can trap; a second instruction that would trap
+// is left to its own handler.
+
+#include "block_cache.h"
+#include "insn_decode.h"
+#include "processor.h"
+
+#define FIRST pair[0].fetch.insn
+#define SECOND pair[1].fetch.insn
+
+// pc of pair[1], and where it falls through to.
+#define PC2 pair[0].next
+#define NPC2 sext_xlen(PC2 + SECOND.length())
+
+// Give pair[1] back to the block loop if jumping to target would trap in
+// set_pc(), or would land on pair[1] itself.
+#define CHECK_TARGET(target) \
+  if (unlikely(((target) & ~p->pc_alignment_mask()) || reg_t(sext_xlen(target)) == PC2)) \
+    return PC2
+
+// lui rd, hi; addi rd, rd, lo
+template<int xlen>
+static reg_t fused_lui_addi(processor_t* p, block_op_t* pair, reg_t pc)
+{
+  WRITE_REG(SECOND.rd(), sext_xlen(FIRST.u_imm() + SECOND.i_imm()));
+  return NPC2;
+}
+
+// auipc rd, hi; jr lo(rd)
+template<int xlen>
+static reg_t fused_auipc_jr(processor_t* p, block_op_t* pair, reg_t pc)
+{
+  reg_t base = sext_xlen(((FIRST.u_imm() >> 1) + (pc >> 1)) << 1);
+  WRITE_REG(FIRST.rd(), base);
+  reg_t target = base + SECOND.i_imm();
+  CHECK_TARGET(target);
+  return sext_xlen(target);
+}
+
+// auipc rs, hi; jalr rd, lo(rs)
+template<int xlen>
+static reg_t fused_auipc_jalr(processor_t* p, block_op_t* pair, reg_t pc)
+{
+  reg_t base = sext_xlen(((FIRST.u_imm() >> 1) + (pc >> 1)) << 1);
+  WRITE_REG(FIRST.rd(), base);
+  reg_t target = base + SECOND.i_imm();
+  CHECK_TARGET(target);
+  WRITE_REG(SECOND.rd(), NPC2 >> 1 << 1);
+  return sext_xlen(target);
+}
+
+// slli rd, rs, a; srli rd, rd, b
+template<int xlen>
+static reg_t fused_slli_srli(processor_t* p, block_op_t* pair, reg_t pc)
+{
+  reg_t x = sext_xlen(READ_REG(FIRST.rs1()) << (FIRST.shamt() & 0x3F));
+  WRITE_REG(SECOND.rd(), sext_xlen(zext_xlen(x) >> (SECOND.shamt() & 0x3F)));
+  return NPC2;
+}
+
+// slt/sltu/slti/sltiu rd, ...; beq/bne rd, zero
+template<int xlen, insn_index_t cmp, bool taken_if_set>
+static reg_t fused_set_branch(processor_t* p, block_op_t* pair, reg_t pc)
+{
+  reg_t a = READ_REG(FIRST.rs1());
+  reg_t set;
+  switch (cmp) {
+    case INSN_slt: set = sreg_t(a) < sreg_t(READ_REG(FIRST.rs2())); break;
+    case INSN_sltu: set = a < READ_REG(FIRST.rs2()); break;
+    case INSN_slti: set = sreg_t(a) < sreg_t(FIRST.i_imm()); break;
+    default: set = a < reg_t(FIRST.i_imm()); break;
+  }
+  WRITE_REG(FIRST.rd(), set);
+
+  if (bool(set) != taken_if_set)
+    return NPC2;
+  reg_t target = PC2 + SECOND.sb_imm();
+  CHECK_TARGET(target);
+  return sext_xlen(target);
+}
+
+template<int xlen, insn_index_t cmp>
+static fused_func_t set_branch(insn_index_t branch)
+{
+  return branch == INSN_bne ? fused_set_branch<xlen, cmp, true>
+                            : fused_set_branch<xlen, cmp, false>;
+}
+
+template<int xlen>
+static fused_func_t find(block_op_t* pair)
+{
+  insn_t first = pair[0].fetch.insn, second = pair[1].fetch.insn;
+  insn_index_t a = insn_decode(first.bits()), b = insn_decode(second.bits());
+  unsigned rd = first.rd();
+
+  // Every idiom feeds rd of the first instruction into the second; with
+  // rd = zero there is nothing to fuse.
+  if (rd == 0 || second.rs1() != rd)
+    return NULL;
+
+  switch (a) {
+    case INSN_lui:
+      if (b == INSN_addi && second.rd() == rd)
+        return fused_lui_addi<xlen>;
+      break;
+    case INSN_auipc:
+      if (b == INSN_jr)
+        return fused_auipc_jr<xlen>;
+      if (b == INSN_jalr)
+        return fused_auipc_jalr<xlen>;
+      break;
+    case INSN_slli:
+      // An out-of-range shift amount traps in the handler.
+      if (b == INSN_srli && second.rd() == rd &&
+          (first.shamt() & 0x3F) < unsigned(xlen) &&
+          (second.shamt() & 0x3F) < unsigned(xlen))
+        return fused_slli_srli<xlen>;
+      break;
+    case INSN_slt:
+    case INSN_sltu:
+    case INSN_slti:
+    case INSN_sltiu:
+      if ((b != INSN_beq && b != INSN_bne) || second.rs2() != 0)
+        break;
+      switch (a) {
+        case INSN_slt: return set_branch<xlen, INSN_slt>(b);
+        case INSN_sltu: return set_branch<xlen, INSN_sltu>(b);
+        case INSN_slti: return set_branch<xlen, INSN_slti>(b);
+        default: return set_branch<xlen, INSN_sltiu>(b);
+      }
+    default:
+      break;
+  }
+  return NULL;
+}
+
+fused_func_t find_fusion(block_op_t* pair, unsigned xlen)
+{
+  if (pair[0].fetch.insn.length() != 4 || pair[1].fetch.insn.length() != 4)
+    return NULL;
+#ifdef LISC32
+  return find<32>(pair);
+#else
+  return xlen == 32 ? find<32>(pair) : find<64>(pair);
+#endif
+}
@@ -0,0 +1,57 @@
+// See LICENSE for license details.
+
+#include "hart_pool.h"
+#include <chrono>
+
+// Spin briefly, since a quantum is usually only tens of microseconds, then
+// yield, then sleep so an idle simulator does not hold a core per thread.
+template<class F>
+static void wait_until(F done)
+{
+  for (unsigned i = 0; !done(); i++) {
+    if (i < 1024) {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    } else if (i < 4096)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+hart_pool_t::hart_pool_t(size_t groups, std::function<void(size_t)> body)
+  : body(body), generation(0), pending(0), stop(false)
+{
+  for (size_t i = 1; i < groups; i++)
+    threads.emplace_back(&hart_pool_t::worker, this, i);
+}
+
+hart_pool_t::~hart_pool_t()
+{
+  stop.store(true, std::memory_order_relaxed);
+  generation.fetch_add(1, std::memory_order_release);
+  for (auto& t : threads)
+    t.join();
+}
+
+void hart_pool_t::run()
+{
+  pending.store(threads.size(), std::memory_order_relaxed);
+  generation.fetch_add(1, std::memory_order_release);
+  body(0);
+  wait_until([this] { return pending.load(std::memory_order_acquire) == 0; });
+}
+
+void hart_pool_t::worker(size_t group)
+{
+  uint64_t seen = 0;
+  while (true) {
+    wait_until([&] { return generation.load(std::memory_order_acquire) != seen; });
+    if (stop.load(std::memory_order_relaxed))
+      return;
+    seen++;
+    body(group);
+    pending.fetch_sub(1, std::memory_order_release);
+  }
+}
@@ -0,0 +1,42 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_HART_POOL_H
+#define _RISCV_HART_POOL_H
+
+// Host threads for running harts in parallel (see sim_t::set_hart_threads).
+// Each call to run() is one quantum: every group runs once, group 0 on the
+// calling thread and the others on threads of their own, and run() returns
+// when all of them have finished.  Between quanta the pool threads spin,
+// then back off to sleeping, so the caller can touch any hart's state.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+class hart_pool_t
+{
+public:
+  hart_pool_t(size_t groups, std::function<void(size_t)> body);
+  ~hart_pool_t();
+
+  size_t groups() const { return threads.size() + 1; }
+  void run();
+
+private:
+  std::function<void(size_t)> body;
+  std::vector<std::thread> threads;
+  // Bumped by run() to start a quantum; the pool threads watch it.
+  std::atomic<uint64_t> generation;
+  char generation_pad[64 - sizeof(std::atomic<uint64_t>)];
+  // Groups still running this quantum; written by every pool thread.
+  std::atomic<size_t> pending;
+  char pending_pad[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<bool> stop;
+
+  void worker(size_t group);
+};
+
+#endif
@@ -0,0 +1,208 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_INSN_FORMAT_H
+#define _RISCV_INSN_FORMAT_H
+
+// The LISC instruction formats, written down once.  insn_t's accessors,
+// the encoders in opcodes.h and the disassembler's operand masks are all
+// built from the fields below, so they cannot disagree about where a field
+// lives.
+//
+// A field is a list of segments, each taking len bits of the instruction
+// word from bit lo and placing them at bit at of the field's value.
+// Extraction and encoding are straight-line shifts and masks.  With BMI2,
+// the split immediates (S, SB and UJ), whose segments are a rotation of one
+// contiguous run of value bits, take a single PEXT or PDEP and a rotate
+// instead.  PEXT and PDEP are microcoded on some older AMD cores, so only
+// build with -mbmi2 for hosts where they are fast.
+
+#include <cstdint>
+#ifdef __BMI2__
+# include <immintrin.h>
+#endif
+
+template<unsigned lo, unsigned len, unsigned at>
+struct insn_segment_t
+{
+  static const unsigned insn_lo = lo;
+  static const unsigned length = len;
+  static const unsigned value_at = at;
+  static const uint64_t mask = ((uint64_t(1) << len) - 1) << lo;
+
+  static inline uint64_t get(uint64_t bits)
+  {
+    return ((bits >> lo) & ((uint64_t(1) << len) - 1)) << at;
+  }
+  static inline uint64_t put(uint64_t value)
+  {
+    return ((value >> at) & ((uint64_t(1) << len) - 1)) << lo;
+  }
+};
+
+template<class... S> struct insn_segments_t;
+
+template<> struct insn_segments_t<>
+{
+  static const unsigned insn_lo = 64;
+  static const uint64_t mask = 0;
+  static const unsigned end = 0;        // one past the top value bit
+  static const unsigned base = 64;      // lowest value bit
+  static const unsigned length = 0;
+  static inline uint64_t get(uint64_t) { return 0; }
+  static inline uint64_t put(uint64_t) { return 0; }
+
+  // The segments after the last one continue where the first started.
+  template<unsigned first_at, unsigned base_, unsigned width>
+  struct rotation_from { static const bool value = true; };
+};
+
+template<class S, class... R>
+struct insn_segments_t<S, R...>
+{
+  typedef insn_segments_t<R...> rest;
+  static_assert(S::insn_lo + S::length <= rest::insn_lo,
+                "segments must be listed in instruction-bit order");
+
+  static const unsigned insn_lo = S::insn_lo;
+  static const uint64_t mask = S::mask | rest::mask;
+  static const unsigned end = S::value_at + S::length > rest::end ?
+                              S::value_at + S::length : rest::end;
+  static const unsigned base = S::value_at < rest::base ? S::value_at : rest::base;
+  static const unsigned length = S::length + rest::length;
+  static inline uint64_t get(uint64_t bits) { return S::get(bits) | rest::get(bits); }
+  static inline uint64_t put(uint64_t value) { return S::put(value) | rest::put(value); }
+
+  // True if, starting at value bit at, S and the segments after it are laid
+  // out end to end, wrapping from the top of the field back to base.
+  template<unsigned at, unsigned base_, unsigned width>
+  struct rotation_from
+  {
+    static const bool value = S::value_at == at &&
+      rest::template rotation_from<(at - base_ + S::length) % width + base_, base_, width>::value;
+  };
+};
+
+template<class S, class... R> struct insn_first_segment_t { typedef S type; };
+
+template<bool is_signed, class... S>
+struct insn_field_t
+{
+  typedef insn_segments_t<S...> segments;
+  typedef typename insn_first_segment_t<S...>::type first;
+
+  static const uint64_t mask = segments::mask;
+  static const unsigned base = segments::base;
+  static const unsigned width = segments::end - segments::base;
+
+  // Split fields whose value bits form one rotated run: PEXT gathers them,
+  // and a rotate puts them in place.
+  static const bool rotated = sizeof...(S) > 1 && segments::length == width &&
+    segments::template rotation_from<first::value_at, base, width>::value;
+  static const unsigned rotate = first::value_at - base;
+
+  static inline uint64_t rotl(uint64_t x, unsigned s)
+  {
+    return s == 0 ? x : ((x << s) | (x >> (width - s))) & ((uint64_t(1) << width) - 1);
+  }
+
+  static inline uint64_t get_unsigned(uint64_t bits)
+  {
+#ifdef __BMI2__
+    if (rotated)
+      return rotl(_pext_u64(bits, mask), rotate) << base;
+#endif
+    return segments::get(bits);
+  }
+
+  // The field's value, sign-extended from its top bit if is_signed.
+  static inline int64_t extract(uint64_t bits)
+  {
+    uint64_t x = get_unsigned(bits);
+    if (is_signed)
+      return int64_t(x << (64 - segments::end)) >> (64 - segments::end);
+    return x;
+  }
+
+  // The instruction bits that hold value in this field.
+  static inline uint64_t encode(uint64_t value)
+  {
+#ifdef __BMI2__
+    if (rotated)
+      return _pdep_u64(rotl((value >> base) & ((uint64_t(1) << width) - 1),
+                            (width - rotate) % width), mask);
+#endif
+    return segments::put(value);
+  }
+};
+
+// No field; encodes nothing.
+struct insn_no_field_t
+{
+  static const uint64_t mask = 0;
+  static inline int64_t extract(uint64_t) { return 0; }
+  static inline uint64_t encode(uint64_t) { return 0; }
+};
+
+// Fields.  Immediates carry the shift of their lowest bit, so their value
+// is the offset the instruction means.
+typedef insn_field_t<false, insn_segment_t<0, 8, 0>> insn_opcode_field_t;
+typedef insn_field_t<false, insn_segment_t<8, 4, 0>> insn_rd_field_t;
+typedef insn_field_t<false, insn_segment_t<24, 4, 0>> insn_rs1_field_t;
+typedef insn_field_t<false, insn_segment_t<20, 4, 0>> insn_rs2_field_t;
+typedef insn_field_t<false, insn_segment_t<16, 4, 0>> insn_rs3_field_t;
+typedef insn_field_t<false, insn_segment_t<12, 3, 0>> insn_rm_field_t;
+typedef insn_field_t<false, insn_segment_t<12, 12, 0>> insn_csr_field_t;
+typedef insn_field_t<false, insn_segment_t<16, 8, 0>> insn_shamt_field_t;
+typedef insn_field_t<false, insn_segment_t<24, 5, 0>> insn_zimm_field_t;
+typedef insn_field_t<true, insn_segment_t<12, 12, 0>> insn_i_imm_field_t;
+typedef insn_field_t<true, insn_segment_t<8, 4, 8>,
+                           insn_segment_t<12, 8, 0>> insn_s_imm_field_t;
+typedef insn_field_t<true, insn_segment_t<8, 4, 8>,
+                           insn_segment_t<12, 1, 12>,
+                           insn_segment_t<13, 7, 1>> insn_sb_imm_field_t;
+typedef insn_field_t<true, insn_segment_t<12, 20, 12>> insn_u_imm_field_t;
+typedef insn_field_t<true, insn_segment_t<8, 4, 16>,
+                           insn_segment_t<12, 1, 20>,
+                           insn_segment_t<13, 15, 1>> insn_uj_imm_field_t;
+// 48- and 64-bit instructions: a length prefix in the low 9 or 10 bits (see
+// insn_length), and the rest of the word is theirs.
+typedef insn_field_t<false, insn_segment_t<9, 39, 0>> insn_long48_field_t;
+typedef insn_field_t<false, insn_segment_t<10, 54, 0>> insn_long64_field_t;
+
+// Formats: which fields an instruction of each kind has.
+template<unsigned len, class Rd, class Rs1, class Rs2, class Imm>
+struct insn_format_t
+{
+  static const unsigned length = len;
+  typedef Rd rd;
+  typedef Rs1 rs1;
+  typedef Rs2 rs2;
+  typedef Imm imm;
+
+  static inline uint64_t encode(uint64_t match, unsigned rd_, unsigned rs1_,
+                                unsigned rs2_, int64_t imm_)
+  {
+    return match | Rd::encode(rd_) | Rs1::encode(rs1_) | Rs2::encode(rs2_) |
+           Imm::encode(imm_);
+  }
+};
+
+typedef insn_format_t<4, insn_rd_field_t, insn_rs1_field_t, insn_rs2_field_t,
+                      insn_no_field_t> insn_r_format_t;
+typedef insn_format_t<4, insn_rd_field_t, insn_rs1_field_t, insn_no_field_t,
+                      insn_i_imm_field_t> insn_i_format_t;
+typedef insn_format_t<4, insn_no_field_t, insn_rs1_field_t, insn_rs2_field_t,
+                      insn_s_imm_field_t> insn_s_format_t;
+typedef insn_format_t<4, insn_no_field_t, insn_rs1_field_t, insn_rs2_field_t,
+                      insn_sb_imm_field_t> insn_sb_format_t;
+typedef insn_format_t<4, insn_rd_field_t, insn_no_field_t, insn_no_field_t,
+                      insn_u_imm_field_t> insn_u_format_t;
+// j and jal: jal always links to ra, so there is no rd field.
+typedef insn_format_t<4, insn_no_field_t, insn_no_field_t, insn_no_field_t,
+                      insn_uj_imm_field_t> insn_uj_format_t;
+typedef insn_format_t<6, insn_no_field_t, insn_no_field_t, insn_no_field_t,
+                      insn_long48_field_t> insn_long48_format_t;
+typedef insn_format_t<8, insn_no_field_t, insn_no_field_t, insn_no_field_t,
+                      insn_long64_field_t> insn_long64_format_t;
+
+#endif
@@ -0,0 +1,84 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_INSN_VARIANT_H
+#define _RISCV_INSN_VARIANT_H
+
+#include "decode.h"
+#include "mmu.h"
+
+// Every instruction handler is also compiled for a few operand shapes (see
+// insn_variant_template.cc).  In a variant, the operands its shape fixes
+// are compile-time constants, so reads of x0 become 0, a write to x0 is
+// dropped after its value is computed, a write to any other register skips
+// regfile_t's zero-register check, and a zero immediate folds away.  The
+// shape is a property of the instruction word, so a variant behaves exactly
+// like the generic handler on every word it is selected for.
+enum insn_shape_t {
+  INSN_SHAPE_RD_ZERO,       // rd is x0
+  INSN_SHAPE_RD,            // rd is not x0
+  INSN_SHAPE_RS1_ZERO,      // ... and rs1 is x0, as in li
+  INSN_SHAPE_IMM_ZERO,      // ... and the immediate is 0, as in mv
+  INSN_SHAPE_RS2_ZERO,      // ... and rs2 is x0
+  NUM_INSN_SHAPES
+};
+
+static inline insn_shape_t insn_shape(insn_t insn)
+{
+  if (insn.rd() == 0)
+    return INSN_SHAPE_RD_ZERO;
+  if (insn.rs1() == 0)
+    return INSN_SHAPE_RS1_ZERO;
+  if (insn.i_imm() == 0)
+    return INSN_SHAPE_IMM_ZERO;
+  if (insn.rs2() == 0)
+    return INSN_SHAPE_RS2_ZERO;
+  return INSN_SHAPE_RD;
+}
+
+template<int shape>
+class insn_variant_t : public insn_t
+{
+public:
+  static const bool rd_zero = shape == INSN_SHAPE_RD_ZERO;
+  static const bool rd_nonzero = !rd_zero;
+  static const bool rs1_zero = shape == INSN_SHAPE_RS1_ZERO;
+  static const bool rs2_zero = shape == INSN_SHAPE_RS2_ZERO;
+  static const bool imm_zero = shape == INSN_SHAPE_IMM_ZERO;
+
+  insn_variant_t(insn_t insn) : insn_t(insn) {}
+
+  uint64_t rd() { return rd_zero ? 0 : insn_t::rd(); }
+  uint64_t rs1() { return rs1_zero ? 0 : insn_t::rs1(); }
+  uint64_t rs2() { return rs2_zero ? 0 : insn_t::rs2(); }
+  int64_t i_imm() { return imm_zero ? 0 : insn_t::i_imm(); }
+  int64_t s_imm() { return imm_zero ? 0 : insn_t::s_imm(); }
+  int64_t sb_imm() { return imm_zero ? 0 : insn_t::sb_imm(); }
+  int64_t u_imm() { return imm_zero ? 0 : insn_t::u_imm(); }
+  int64_t uj_imm() { return imm_zero ? 0 : insn_t::uj_imm(); }
+};
+
+// The generic handlers of one instruction and their shaped variants.
+struct insn_variants_t
+{
+  insn_func_t rv32;
+  insn_func_t rv64;
+  insn_func_t rv32_shaped[NUM_INSN_SHAPES];
+  insn_func_t rv64_shaped[NUM_INSN_SHAPES];
+
+  // The variant of generic for insn's shape.  Handlers that are not ours,
+  // such as ones an extension installed, are returned unchanged.
+  insn_func_t select(insn_func_t generic, insn_t insn) const
+  {
+    if (generic == rv64)
+      return rv64_shaped[insn_shape(insn)];
+    if (generic == rv32)
+      return rv32_shaped[insn_shape(insn)];
+    return generic;
+  }
+};
+
+#define INSN_VARIANTS(f) { \
+  f<INSN_SHAPE_RD_ZERO>, f<INSN_SHAPE_RD>, f<INSN_SHAPE_RS1_ZERO>, \
+  f<INSN_SHAPE_IMM_ZERO>, f<INSN_SHAPE_RS2_ZERO> }
+
+#endif
@@ -0,0 +1,41 @@
+
+// Operand-shape variants of the handlers above; see insn_variant.h.  This
+// is appended to insn_template.cc when the per-instruction sources are
+// generated.
+
+#include "insn_variant.h"
+
+// Only the block loop runs these, and it turns PC_ILLEGAL_INSN into the
+// trap, so they report illegal instructions without unwinding.
+#undef raise_illegal_insn
+#define raise_illegal_insn() return PC_ILLEGAL_INSN
+
+template<int shape>
+static reg_t rv32_NAME_shaped(processor_t* p, insn_t generic_insn, reg_t pc)
+{
+  int xlen = 32;
+  insn_variant_t<shape> insn(generic_insn);
+  reg_t npc = sext_xlen(pc + insn_length(OPCODE));
+  #include "insns/NAME.h"
+  trace_opcode(p, OPCODE, insn);
+  return npc;
+}
+
+template<int shape>
+static reg_t rv64_NAME_shaped(processor_t* p, insn_t generic_insn, reg_t pc)
+{
+  int xlen = 64;
+  insn_variant_t<shape> insn(generic_insn);
+  reg_t npc = sext_xlen(pc + insn_length(OPCODE));
+  #include "insns/NAME.h"
+  trace_opcode(p, OPCODE, insn);
+  return npc;
+}
+
+extern const insn_variants_t NAME_variants;
+const insn_variants_t NAME_variants = {
+  rv32_NAME,
+  rv64_NAME,
+  INSN_VARIANTS(rv32_NAME_shaped),
+  INSN_VARIANTS(rv64_NAME_shaped),
+};
@@ -0,0 +1,7 @@
+require_extension('C');
+require_extension('D');
+require_fp;
+reg_t addr = RVC_RS1S + insn.rvc_ld_imm();
+uint64_t data = MMU.load_uint64(addr);
+LOG_MEM(addr, data, 8, false);
+WRITE_RVC_FRS2S(f64(data));
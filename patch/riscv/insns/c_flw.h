@@ -0,0 +1,14 @@
+require_extension('C');
+if (xlen == 32) {
+  require_extension('F');
+  require_fp;
+  reg_t addr = RVC_RS1S + insn.rvc_lw_imm();
+  uint32_t data = MMU.load_uint32(addr);
+  LOG_MEM(addr, data, 4, false);
+  WRITE_RVC_FRS2S(f32(data));
+} else { // c.ld
+  reg_t addr = RVC_RS1S + insn.rvc_ld_imm();
+  reg_t data = MMU.load_int64(addr);
+  LOG_MEM(addr, data, 8, false);
+  WRITE_RVC_RS2S(data);
+}
@@ -0,0 +1,15 @@
+require_extension('C');
+if (xlen == 32) {
+  require_extension('F');
+  require_fp;
+  reg_t addr = RVC_SP + insn.rvc_lwsp_imm();
+  uint32_t data = MMU.load_uint32(addr);
+  LOG_MEM(addr, data, 4, false);
+  WRITE_FRD(f32(data));
+} else { // c.ldsp
+  require(insn.rvc_rd() != 0);
+  reg_t addr = RVC_SP + insn.rvc_ldsp_imm();
+  reg_t data = MMU.load_int64(addr);
+  LOG_MEM(addr, data, 8, false);
+  WRITE_RD(data);
+}
@@ -0,0 +1,7 @@
+require_extension('C');
+require_extension('D');
+require_fp;
+reg_t addr = RVC_SP + insn.rvc_sdsp_imm();
+uint64_t data = RVC_FRS2.v[0];
+MMU.store_uint64(addr, data);
+LOG_MEM(addr, data, 8, true);
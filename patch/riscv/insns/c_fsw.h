@@ -0,0 +1,13 @@
+require_extension('C');
+if (xlen == 32) {
+  require_extension('F');
+  require_fp;
+  reg_t addr = RVC_RS1S + insn.rvc_lw_imm();
+  uint32_t data = RVC_FRS2S.v[0];
+  MMU.store_uint32(addr, data);
+  LOG_MEM(addr, data, 4, true);
+} else { // c.sd
+  reg_t addr = RVC_RS1S + insn.rvc_ld_imm();
+  MMU.store_uint64(addr, RVC_RS2S);
+  LOG_MEM(addr, RVC_RS2S, 8, true);
+}
@@ -0,0 +1,13 @@
+require_extension('C');
+if (xlen == 32) {
+  require_extension('F');
+  require_fp;
+  reg_t addr = RVC_SP + insn.rvc_swsp_imm();
+  uint32_t data = RVC_FRS2.v[0];
+  MMU.store_uint32(addr, data);
+  LOG_MEM(addr, data, 4, true);
+} else { // c.sdsp
+  reg_t addr = RVC_SP + insn.rvc_sdsp_imm();
+  MMU.store_uint64(addr, RVC_RS2);
+  LOG_MEM(addr, RVC_RS2, 8, true);
+}
@@ -0,0 +1,5 @@
+require_extension('C');
+reg_t addr = RVC_RS1S + insn.rvc_lw_imm();
+reg_t data = MMU.load_int32(addr);
+LOG_MEM(addr, data, 4, false);
+WRITE_RVC_RS2S(data);
@@ -0,0 +1,6 @@
+require_extension('C');
+require(insn.rvc_rd() != 0);
+reg_t addr = RVC_SP + insn.rvc_lwsp_imm();
+reg_t data = MMU.load_int32(addr);
+LOG_MEM(addr, data, 4, false);
+WRITE_RD(data);
@@ -0,0 +1,4 @@
+require_extension('C');
+reg_t addr = RVC_RS1S + insn.rvc_lw_imm();
+MMU.store_uint32(addr, RVC_RS2S);
+LOG_MEM(addr, RVC_RS2S, 4, true);
@@ -0,0 +1,4 @@
+require_extension('C');
+reg_t addr = RVC_SP + insn.rvc_swsp_imm();
+MMU.store_uint32(addr, RVC_RS2);
+LOG_MEM(addr, RVC_RS2, 4, true);
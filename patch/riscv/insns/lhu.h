@@ -0,0 +1,4 @@
+reg_t addr = RS1 + insn.i_imm();
+reg_t data = MMU.load_uint16(addr);
+LOG_MEM(addr, data, 2, false);
+WRITE_RD(data);
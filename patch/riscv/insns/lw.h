@@ -0,0 +1,4 @@
+reg_t addr = RS1 + insn.i_imm();
+reg_t data = MMU.load_int32(addr);
+LOG_MEM(addr, data, 4, false);
+WRITE_RD(data);
@@ -0,0 +1,3 @@
+reg_t addr = RS1 + insn.s_imm();
+MMU.store_uint32(addr, RS2);
+LOG_MEM(addr, RS2, 4, true);
@@ -0,0 +1,507 @@
+// See LICENSE for license details.
+
+#include "jit.h"
+#include "processor.h"
+#include "mmu.h"
+#include <cstddef>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+
+// x86-64 register numbers.  Guest registers live in memory at [rbx + 8*i],
+// rbp holds the jit_frame_t, and rax/rcx/rdx/rsi/rdi are scratch.
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7 };
+
+// Condition codes, as used by jcc and setcc.
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc, CC_GE = 0xd };
+
+// Opcode extensions for the 0x81 (ALU imm32), 0xc1/0xd3 (shift) and 0xf7
+// (unary) groups.
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+enum { SH_SHL = 4, SH_SHR = 5, SH_SAR = 7 };
+enum { UN_NEG = 3, UN_MUL = 4, UN_IMUL = 5, UN_DIV = 6, UN_IDIV = 7 };
+
+// Opcodes of the "op r/m64, r64" forms.
+enum { OP_ADD = 0x01, OP_OR = 0x09, OP_AND = 0x21, OP_SUB = 0x29,
+       OP_XOR = 0x31, OP_CMP = 0x39, OP_MOV = 0x89 };
+
+class jit_emitter_t
+{
+public:
+  jit_emitter_t(jit_t* jit, block_t* b)
+    : jit(jit), b(b), p(jit->proc), xlen(jit->xlen),
+      start(jit->code + jit->code_used), pos(start),
+      end(jit->code + jit_t::CODE_SIZE) {}
+
+  jit_code_t translate();
+
+private:
+  // Longest sequence emitted for a single op, including its exit.
+  static const size_t MAX_OP_BYTES = 128;
+
+  jit_t* jit;
+  block_t* b;
+  processor_t* p;
+  unsigned xlen;
+  uint8_t* start;
+  uint8_t* pos;
+  uint8_t* end;
+  std::vector<uint8_t*> epilogue_jumps;
+
+  reg_t sext(reg_t x) { return sext_xlen(x); }
+
+  void byte(uint8_t x) { *pos++ = x; }
+  void u32(uint32_t x) { memcpy(pos, &x, 4); pos += 4; }
+  void u64(uint64_t x) { memcpy(pos, &x, 8); pos += 8; }
+
+  // op r/m64, r64 with both operands in registers
+  void rr(uint8_t op, int reg, int rm) { byte(0x48); byte(op); byte(0xc0 | reg << 3 | rm); }
+  void alu_imm(int ext, int rm, int32_t imm) { byte(0x48); byte(0x81); byte(0xc0 | ext << 3 | rm); u32(imm); }
+  void shift_imm(int ext, int rm, unsigned n) { byte(0x48); byte(0xc1); byte(0xc0 | ext << 3 | rm); byte(n); }
+  void shift_cl(int ext, int rm) { byte(0x48); byte(0xd3); byte(0xc0 | ext << 3 | rm); }
+  void unary(int ext, int rm) { byte(0x48); byte(0xf7); byte(0xc0 | ext << 3 | rm); }
+  void imul(int reg, int rm) { byte(0x48); byte(0x0f); byte(0xaf); byte(0xc0 | reg << 3 | rm); }
+  void cqo() { byte(0x48); byte(0x99); }
+  void movsxd(int r) { byte(0x48); byte(0x63); byte(0xc0 | r << 3 | r); }
+  void movzx32(int r) { byte(0x89); byte(0xc0 | r << 3 | r); }
+  void setcc_rax(int cc) { byte(0x0f); byte(0x90 | cc); byte(0xc0); byte(0x0f); byte(0xb6); byte(0xc0); }
+
+  void imm(int r, uint64_t x)
+  {
+    if (int64_t(x) == int32_t(x)) {
+      byte(0x48); byte(0xc7); byte(0xc0 | r); u32(x);
+    } else {
+      byte(0x48); byte(0xb8 | r); u64(x);
+    }
+  }
+
+  // 32-bit registers (LISC32) are sign-extended by the load and truncated
+  // by the store.
+  static const bool narrow_regs = sizeof(xreg_storage_t) == 4;
+  void load(int r, unsigned x)
+  {
+    byte(0x48); byte(narrow_regs ? 0x63 : 0x8b); byte(0x83 | r << 3);
+    u32(x * sizeof(xreg_storage_t));
+  }
+  void store(unsigned x, int r)
+  {
+    if (x != 0) {
+      if (!narrow_regs)
+        byte(0x48);
+      byte(0x89); byte(0x83 | r << 3); u32(x * sizeof(xreg_storage_t));
+    }
+  }
+
+  // Keep register values in the sext_xlen form the handlers write.  Every
+  // result goes straight to store(), which does that itself for LISC32.
+  void sext_result(int r) { if (xlen == 32 && !narrow_regs) movsxd(r); }
+  void sext_operand(int r) { if (xlen == 32) movsxd(r); }
+  void zext_operand(int r) { if (xlen == 32) movzx32(r); }
+
+  uint8_t* jcc(int cc) { byte(0x0f); byte(0x80 | cc); u32(0); return pos; }
+  uint8_t* jmp() { byte(0xe9); u32(0); return pos; }
+  void bind(uint8_t* after_jump) { bind(after_jump, pos); }
+  void bind(uint8_t* after_jump, uint8_t* target)
+  {
+    int32_t rel = target - after_jump;
+    memcpy(after_jump - 4, &rel, 4);
+  }
+
+  // Leave the block after op k, which returned npc.
+  void exit(size_t k, reg_t npc)
+  {
+    imm(RAX, npc);
+    exit_rax(k);
+  }
+  void exit_rax(size_t k)
+  {
+    byte(0x48); byte(0x89); byte(0x45); byte(offsetof(jit_frame_t, npc));
+    byte(0xb8); u32(k);
+    epilogue_jumps.push_back(jmp());
+  }
+
+  bool aligned(reg_t target) { return (target & ~p->pc_alignment_mask()) == 0; }
+
+  bool emit_inline(size_t k, reg_t pc, insn_t insn, reg_t next);
+  void emit_call(size_t k, reg_t pc, reg_t next);
+  void emit_branch(size_t k, int cc, reg_t taken, reg_t fallthrough, reg_t next);
+  void emit_div(bool is_signed, bool rem);
+};
+
+jit_code_t jit_emitter_t::translate()
+{
+  // push rbp; push rbx; sub rsp, 8; mov rbp, rdi; mov rbx, [rbp + regs]
+  byte(0x55); byte(0x53);
+  byte(0x48); byte(0x83); byte(0xec); byte(0x08);
+  rr(OP_MOV, RDI, RBP);
+  byte(0x48); byte(0x8b); byte(0x5d); byte(offsetof(jit_frame_t, regs));
+
+  size_t inlined = 0;
+  reg_t pc = b->tag;
+  for (size_t k = 0; k < b->length; k++) {
+    if (size_t(end - pos) < MAX_OP_BYTES) {
+      jit->out_of_space = true;
+      return NULL;
+    }
+
+    block_op_t& op = b->ops[k];
+    if (emit_inline(k, pc, op.fetch.insn, op.next))
+      inlined++;
+    else
+      emit_call(k, pc, op.next);
+    pc = op.next;
+  }
+
+  if (size_t(end - pos) < MAX_OP_BYTES) {
+    jit->out_of_space = true;
+    return NULL;
+  }
+  if (inlined == 0)
+    return NULL;
+
+  imm(RAX, pc);
+  byte(0x48); byte(0x89); byte(0x45); byte(offsetof(jit_frame_t, npc));
+  byte(0xb8); u32(b->length);
+
+  for (auto j : epilogue_jumps)
+    bind(j);
+  // add rsp, 8; pop rbx; pop rbp; ret
+  byte(0x48); byte(0x83); byte(0xc4); byte(0x08);
+  byte(0x5b); byte(0x5d); byte(0xc3);
+
+  jit->code_used = pos - jit->code;
+  return (jit_code_t)start;
+}
+
+void jit_emitter_t::emit_call(size_t k, reg_t pc, reg_t next)
+{
+  rr(OP_MOV, RBP, RDI);
+  imm(RSI, k);
+  imm(RDX, pc);
+  imm(RAX, (uint64_t)&jit_t::call_out);
+  byte(0xff); byte(0xd0); // call rax
+
+  imm(RCX, next);
+  rr(OP_CMP, RCX, RAX);
+  uint8_t* expected = jcc(CC_E);
+  exit_rax(k);
+  bind(expected);
+}
+
+void jit_emitter_t::emit_branch(size_t k, int cc, reg_t taken, reg_t fallthrough, reg_t next)
+{
+  load(RAX, b->ops[k].fetch.insn.rs1());
+  load(RCX, b->ops[k].fetch.insn.rs2());
+  rr(OP_CMP, RCX, RAX);
+
+  if (taken == next && fallthrough == next)
+    return;
+  if (taken != next && fallthrough != next) {
+    uint8_t* is_taken = jcc(cc);
+    exit(k, fallthrough);
+    bind(is_taken);
+    exit(k, taken);
+    return;
+  }
+  uint8_t* stay = jcc(taken == next ? cc : cc ^ 1);
+  exit(k, taken == next ? fallthrough : taken);
+  bind(stay);
+}
+
+// rax = rs1 op rs2, following div.h, divu.h, rem.h and remu.h: division by
+// zero and signed overflow produce the ISA-defined results, never a host
+// #DE.
+void jit_emitter_t::emit_div(bool is_signed, bool rem)
+{
+  if (is_signed) {
+    sext_operand(RAX);
+    sext_operand(RCX);
+  } else {
+    zext_operand(RAX);
+    zext_operand(RCX);
+  }
+
+  alu_imm(ALU_CMP, RCX, 0);
+  uint8_t* by_zero = jcc(CC_E);
+  uint8_t* by_minus_one = NULL;
+  if (is_signed) {
+    alu_imm(ALU_CMP, RCX, -1);
+    by_minus_one = jcc(CC_E);
+    cqo();
+    unary(UN_IDIV, RCX);
+  } else {
+    imm(RDX, 0);
+    unary(UN_DIV, RCX);
+  }
+  if (rem)
+    rr(OP_MOV, RDX, RAX);
+  uint8_t* divided = jmp();
+
+  uint8_t* negated = NULL;
+  if (by_minus_one) {
+    bind(by_minus_one);
+    if (rem)
+      imm(RAX, 0);
+    else
+      unary(UN_NEG, RAX);
+    negated = jmp();
+  }
+
+  // The dividend is already in rax for rem and remu.
+  bind(by_zero);
+  if (!rem)
+    imm(RAX, UINT64_MAX);
+
+  bind(divided);
+  if (negated)
+    bind(negated);
+  sext_result(RAX);
+}
+
+bool jit_emitter_t::emit_inline(size_t k, reg_t pc, insn_t insn, reg_t next)
+{
+  #define IS_INSN(name) ((insn.bits() & MASK_##name) == MATCH_##name)
+
+  if (insn.length() != 4)
+    return false;
+
+  unsigned rd = insn.rd(), rs1 = insn.rs1(), rs2 = insn.rs2();
+
+  // Register-register ops
+  struct { insn_bits_t match; uint8_t op; bool sext; } alu_rr[] = {
+    {MATCH_ADD, OP_ADD, true}, {MATCH_SUB, OP_SUB, true},
+    {MATCH_XOR, OP_XOR, false}, {MATCH_OR, OP_OR, false}, {MATCH_AND, OP_AND, false},
+  };
+  for (auto& a : alu_rr) {
+    if ((insn.bits() & MASK_ADD) == a.match) {
+      load(RAX, rs1);
+      load(RCX, rs2);
+      rr(a.op, RCX, RAX);
+      if (a.sext)
+        sext_result(RAX);
+      store(rd, RAX);
+      return true;
+    }
+  }
+
+  if (IS_INSN(SLL) || IS_INSN(SRL) || IS_INSN(SRA)) {
+    load(RAX, rs1);
+    load(RCX, rs2);
+    if (IS_INSN(SRL))
+      zext_operand(RAX);
+    if (IS_INSN(SRA))
+      sext_operand(RAX);
+    alu_imm(ALU_AND, RCX, xlen - 1);
+    shift_cl(IS_INSN(SLL) ? SH_SHL : IS_INSN(SRL) ? SH_SHR : SH_SAR, RAX);
+    sext_result(RAX);
+    store(rd, RAX);
+    return true;
+  }
+
+  if (IS_INSN(SLT) || IS_INSN(SLTU)) {
+    load(RAX, rs1);
+    load(RCX, rs2);
+    rr(OP_CMP, RCX, RAX);
+    setcc_rax(IS_INSN(SLT) ? CC_L : CC_B);
+    store(rd, RAX);
+    return true;
+  }
+
+  // Register-immediate ops
+  struct { insn_bits_t match; int ext; bool sext; } alu_ri[] = {
+    {MATCH_ADDI, ALU_ADD, true}, {MATCH_XORI, ALU_XOR, false},
+    {MATCH_ORI, ALU_OR, false}, {MATCH_ANDI, ALU_AND, false},
+  };
+  for (auto& a : alu_ri) {
+    if ((insn.bits() & MASK_ADDI) == a.match) {
+      load(RAX, rs1);
+      alu_imm(a.ext, RAX, insn.i_imm());
+      if (a.sext)
+        sext_result(RAX);
+      store(rd, RAX);
+      return true;
+    }
+  }
+
+  if (IS_INSN(SLTI) || IS_INSN(SLTIU)) {
+    load(RAX, rs1);
+    alu_imm(ALU_CMP, RAX, insn.i_imm());
+    setcc_rax(IS_INSN(SLTI) ? CC_L : CC_B);
+    store(rd, RAX);
+    return true;
+  }
+
+  if (IS_INSN(SLLI) || IS_INSN(SRLI) || IS_INSN(SRAI)) {
+    // require(SHAMT < xlen) traps; leave that to the handler.
+    if (SHAMT >= xlen)
+      return false;
+    load(RAX, rs1);
+    if (IS_INSN(SRLI))
+      zext_operand(RAX);
+    if (IS_INSN(SRAI))
+      sext_operand(RAX);
+    shift_imm(IS_INSN(SLLI) ? SH_SHL : IS_INSN(SRLI) ? SH_SHR : SH_SAR, RAX, SHAMT);
+    sext_result(RAX);
+    store(rd, RAX);
+    return true;
+  }
+
+  if (IS_INSN(LUI)) {
+    imm(RAX, insn.u_imm());
+    store(rd, RAX);
+    return true;
+  }
+
+  if (IS_INSN(AUIPC)) {
+    imm(RAX, sext(((insn.u_imm() >> 1) + (pc >> 1)) << 1));
+    store(rd, RAX);
+    return true;
+  }
+
+  // M extension.  misa writes flush every block, so the extension can be
+  // checked once here instead of on every execution.
+  if (IS_INSN(MUL) || IS_INSN(MULH) || IS_INSN(MULHSU) || IS_INSN(MULHU) ||
+      IS_INSN(DIV) || IS_INSN(DIVU) || IS_INSN(REM) || IS_INSN(REMU)) {
+    if (!p->supports_extension('M'))
+      return false;
+
+    load(RAX, rs1);
+    load(RCX, rs2);
+    if (IS_INSN(MUL)) {
+      imul(RAX, RCX);
+      sext_result(RAX);
+    } else if (xlen == 64 && IS_INSN(MULH)) {
+      unary(UN_IMUL, RCX);
+      rr(OP_MOV, RDX, RAX);
+    } else if (xlen == 64 && IS_INSN(MULHU)) {
+      unary(UN_MUL, RCX);
+      rr(OP_MOV, RDX, RAX);
+    } else if (xlen == 64 && IS_INSN(MULHSU)) {
+      // mulhu(a, b) - (a < 0 ? b : 0)
+      rr(OP_MOV, RAX, RSI);
+      unary(UN_MUL, RCX);
+      shift_imm(SH_SAR, RSI, 63);
+      rr(OP_AND, RCX, RSI);
+      rr(OP_SUB, RSI, RDX);
+      rr(OP_MOV, RDX, RAX);
+    } else if (IS_INSN(MULH) || IS_INSN(MULHU) || IS_INSN(MULHSU)) {
+      // RV32: the full product fits in 64 bits.
+      if (IS_INSN(MULHU))
+        zext_operand(RAX);
+      else
+        sext_operand(RAX);
+      if (IS_INSN(MULH))
+        sext_operand(RCX);
+      else
+        zext_operand(RCX);
+      imul(RAX, RCX);
+      shift_imm(SH_SAR, RAX, 32);
+      movsxd(RAX);
+    } else {
+      emit_div(IS_INSN(DIV) || IS_INSN(REM), IS_INSN(REM) || IS_INSN(REMU));
+    }
+    store(rd, RAX);
+    return true;
+  }
+
+  // Control transfers with a target known now.  set_pc() traps on a
+  // misaligned target, so those are left to the handler.
+  reg_t fallthrough = sext(pc + insn.length());
+
+  struct { insn_bits_t match; int cc; } branches[] = {
+    {MATCH_BEQ, CC_E}, {MATCH_BNE, CC_NE}, {MATCH_BLT, CC_L},
+    {MATCH_BGE, CC_GE}, {MATCH_BLTU, CC_B}, {MATCH_BGEU, CC_AE},
+  };
+  for (auto& br : branches) {
+    if ((insn.bits() & MASK_BEQ) == br.match) {
+      reg_t target = pc + insn.sb_imm();
+      if (!aligned(target))
+        return false;
+      emit_branch(k, br.cc, sext(target), fallthrough, next);
+      return true;
+    }
+  }
+
+  if (IS_INSN(J) || IS_INSN(JAL)) {
+    reg_t target = pc + insn.uj_imm();
+    if (!aligned(target))
+      return false;
+    if (IS_INSN(JAL)) {
+      imm(RAX, fallthrough >> 1 << 1);
+      store(X_RA, RAX);
+    }
+    if (sext(target) != next)
+      exit(k, sext(target));
+    return true;
+  }
+
+  return false;
+
+  #undef IS_INSN
+}
+
+jit_t::jit_t(processor_t* proc)
+  : proc(proc), regs(proc->get_state()->XPR.raw()),
+    xlen(proc->get_max_xlen()), code_used(0), out_of_space(false)
+{
+  void* p = mmap(NULL, CODE_SIZE, PROT_READ | PROT_EXEC,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  code = p == MAP_FAILED ? NULL : (uint8_t*)p;
+}
+
+jit_t::~jit_t()
+{
+  if (code)
+    munmap(code, CODE_SIZE);
+}
+
+jit_code_t jit_t::translate(block_t* b)
+{
+  if (!code)
+    return NULL;
+
+  // Open up only the pages the new block can land in; the translations
+  // before it stay executable and read-only.
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  uint8_t* first = code + code_used / page_size * page_size;
+  size_t len = code + CODE_SIZE - first;
+  if (mprotect(first, len, PROT_READ | PROT_WRITE) != 0)
+    return NULL;
+  jit_code_t native = jit_emitter_t(this, b).translate();
+  if (mprotect(first, len, PROT_READ | PROT_EXEC) != 0)
+    abort();
+  return native;
+}
+
+#else
+
+jit_t::jit_t(processor_t* proc)
+  : proc(proc), regs(NULL), xlen(0), code(NULL), code_used(0),
+    out_of_space(false)
+{
+}
+
+jit_t::~jit_t()
+{
+}
+
+jit_code_t jit_t::translate(block_t* b)
+{
+  return NULL;
+}
+
+#endif
+
+reg_t jit_t::call_out(jit_frame_t* f, size_t k, reg_t pc)
+{
+  block_op_t& op = f->ops[k];
+  try {
+    return op.fetch.func(f->proc, op.fetch.insn, pc);
+  } catch (...) {
+    // Keep the trap from unwinding through translated code; run() rethrows
+    // it.  Any value other than op.next stops the block here.
+    f->jit->trap = std::current_exception();
+    return ~op.next;
+  }
+}
@@ -0,0 +1,85 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_JIT_H
+#define _RISCV_JIT_H
+
+#include "block_cache.h"
+#include <exception>
+#include <vector>
+
+class processor_t;
+
+// What translated code sees of the hart.  It has to stay a plain struct,
+// since the generated code addresses its fields by offset.
+struct jit_frame_t
+{
+  reg_t npc;          // PC returned by the op that stopped the block
+  xreg_storage_t* regs; // STATE.XPR
+  processor_t* proc;
+  block_op_t* ops;
+  class jit_t* jit;
+};
+
+// Translates hot blocks into x86-64 code.  Integer and M-extension ops are
+// emitted inline; every other op is run through its interpreter handler by
+// a call out of the translated code, so traps are still raised by the
+// handler itself and never unwind through generated frames.
+class jit_t
+{
+public:
+  static const size_t CODE_SIZE = 4 << 20;
+
+  jit_t(processor_t* proc);
+  ~jit_t();
+
+  // False if the host cannot run translated code.
+  bool usable() { return code != NULL; }
+
+  // True if the last translate() failed for want of space; the caller
+  // should drop every translation it holds and flush().
+  bool full() { return out_of_space; }
+
+  // Drop all translations.
+  void flush() { code_used = 0; out_of_space = false; }
+
+  // Translate b, or return NULL if nothing in it is worth translating or
+  // the code buffer is full.  The buffer is only writable while a block is
+  // being emitted into it, and executable the rest of the time.
+  jit_code_t translate(block_t* b);
+
+  // Run b's translation from pc.  Returns the number of ops that went to
+  // their expected next PC, like the interpreter loop in sim_t::step_blocks,
+  // and sets npc to what the op after them returned.  A trap raised by a
+  // called-out op is rethrown once the caller has accounted for those ops.
+  inline size_t run(block_t* b, reg_t* npc)
+  {
+    jit_frame_t f = {0, regs, proc, b->ops, this};
+    size_t k = b->native(&f);
+    *npc = f.npc;
+    return k;
+  }
+
+  inline void rethrow_trap()
+  {
+    if (unlikely(trap != nullptr)) {
+      std::exception_ptr t = trap;
+      trap = nullptr;
+      std::rethrow_exception(t);
+    }
+  }
+
+private:
+  processor_t* proc;
+  xreg_storage_t* regs;
+  unsigned xlen;
+  uint8_t* code;
+  size_t code_used;
+  bool out_of_space;
+  std::exception_ptr trap;
+
+  static reg_t call_out(jit_frame_t* f, size_t k, reg_t pc);
+
+  friend class jit_emitter_t;
+};
+
+#endif
@@ -0,0 +1,365 @@
+// See LICENSE for license details.
+
+// Translates a statically linked LISC ELF into C++, one function per basic
+// block.  Each op is the instruction's own insns/*.h handler with the
+// instruction word fixed, so the compiler can fold the operand fields.
+// The output defines main(), which runs the program on the simulator with
+// these blocks registered; code they do not cover, and anything reached
+// through a jr/jalr target that is not a block entry, is interpreted.
+//
+// The output includes insn_template.h and insns/*.h, so compile it with the
+// simulator's source and build directories on the include path and link it
+// with the simulator's libraries.
+
+#include "decode.h"
+#include "block_cache.h"
+#include "insn_decode.h"
+#include <elf.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct segment_t
+{
+  reg_t vaddr;
+  std::vector<uint8_t> data;
+};
+
+struct program_t
+{
+  unsigned xlen;
+  reg_t entry;
+  std::vector<segment_t> text;      // executable PT_LOAD segments
+  std::set<reg_t> symbols;          // symbol values in text
+
+  bool read16(reg_t addr, uint16_t* x)
+  {
+    for (auto& s : text) {
+      if (addr >= s.vaddr && addr + 2 <= s.vaddr + s.data.size()) {
+        memcpy(x, &s.data[addr - s.vaddr], 2);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Fetch the instruction at addr the way mmu_t::load_insn does.
+  bool fetch(reg_t addr, insn_bits_t* insn)
+  {
+    uint16_t parcels[4];
+    if (!read16(addr, &parcels[0]))
+      return false;
+    int length = insn_length(parcels[0]);
+    for (int i = 1; i < length / 2; i++)
+      if (!read16(addr + 2 * i, &parcels[i]))
+        return false;
+
+    *insn = (insn_bits_t)(int16_t)parcels[length / 2 - 1] << (8 * (length - 2));
+    for (int i = 0; i < length / 2 - 1; i++)
+      *insn |= (insn_bits_t)parcels[i] << (16 * i);
+    return true;
+  }
+};
+
+// Whether len bytes at off lie inside the file.
+static bool in_file(const std::vector<char>& file, uint64_t off, uint64_t len)
+{
+  return off <= file.size() && len <= file.size() - off;
+}
+
+// Copies a T out of the file; headers need not be aligned in it.
+template<class T>
+static bool read_at(const std::vector<char>& file, uint64_t off, T* x)
+{
+  if (!in_file(file, off, sizeof(T)))
+    return false;
+  memcpy(x, &file[off], sizeof(T));
+  return true;
+}
+
+// False if a header, segment or section lies outside the file.
+template<class Ehdr, class Phdr, class Shdr, class Sym, unsigned char (*sym_type)(unsigned char)>
+static bool load_elf(const std::vector<char>& file, program_t* prog)
+{
+  Ehdr eh;
+  if (!read_at(file, 0, &eh))
+    return false;
+  prog->entry = eh.e_entry;
+
+  if (eh.e_phnum && eh.e_phentsize < sizeof(Phdr))
+    return false;
+  for (unsigned i = 0; i < eh.e_phnum; i++) {
+    Phdr ph;
+    if (!read_at(file, eh.e_phoff + uint64_t(i) * eh.e_phentsize, &ph))
+      return false;
+    if (ph.p_type != PT_LOAD || !(ph.p_flags & PF_X))
+      continue;
+    if (!in_file(file, ph.p_offset, ph.p_filesz))
+      return false;
+    segment_t s;
+    s.vaddr = ph.p_vaddr;
+    s.data.assign(&file[0] + ph.p_offset, &file[0] + ph.p_offset + ph.p_filesz);
+    prog->text.push_back(s);
+  }
+
+  if (eh.e_shnum && eh.e_shentsize < sizeof(Shdr))
+    return false;
+  for (unsigned i = 0; i < eh.e_shnum; i++) {
+    Shdr sh;
+    if (!read_at(file, eh.e_shoff + uint64_t(i) * eh.e_shentsize, &sh))
+      return false;
+    if (sh.sh_type != SHT_SYMTAB)
+      continue;
+    if (!in_file(file, sh.sh_offset, sh.sh_size))
+      return false;
+    for (size_t j = 0; j < sh.sh_size / sizeof(Sym); j++) {
+      Sym sym;
+      read_at(file, sh.sh_offset + j * sizeof(Sym), &sym);
+      unsigned char type = sym_type(sym.st_info);
+      if (sym.st_shndx != SHN_UNDEF && (type == STT_FUNC || type == STT_NOTYPE))
+        prog->symbols.insert(sym.st_value);
+    }
+  }
+  return true;
+}
+
+static unsigned char elf32_st_type(unsigned char info) { return ELF32_ST_TYPE(info); }
+static unsigned char elf64_st_type(unsigned char info) { return ELF64_ST_TYPE(info); }
+
+static bool load_program(const char* fn, program_t* prog)
+{
+  std::ifstream in(fn, std::ios::binary);
+  std::vector<char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (!in.eof() && !in.good())
+    return false;
+  if (file.size() < EI_NIDENT || memcmp(&file[0], ELFMAG, SELFMAG) != 0 ||
+      file[EI_DATA] != ELFDATA2LSB)
+    return false;
+
+  if (file[EI_CLASS] == ELFCLASS32) {
+    prog->xlen = 32;
+    return load_elf<Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr, Elf32_Sym, elf32_st_type>(file, prog);
+  } else if (file[EI_CLASS] == ELFCLASS64) {
+    prog->xlen = 64;
+    return load_elf<Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr, Elf64_Sym, elf64_st_type>(file, prog);
+  }
+  return false;
+}
+
+struct op_t
+{
+  insn_bits_t bits;
+  const insn_decode_info_t* info;
+};
+
+class translator_t
+{
+public:
+  translator_t(program_t* prog) : prog(prog), xlen(prog->xlen) {}
+
+  void run(FILE* out);
+
+private:
+  program_t* prog;
+  unsigned xlen;
+  std::map<reg_t, op_t> code;
+  std::set<reg_t> leaders;
+
+  reg_t sext(reg_t x) { return sext_xlen(x); }
+
+  void decode();
+  void find_leaders();
+  void emit_handler(FILE* out, const insn_decode_info_t* info);
+  size_t emit_block(FILE* out, reg_t pc, std::vector<op_t>* ops);
+};
+
+void translator_t::decode()
+{
+  for (auto& s : prog->text) {
+    reg_t pc = s.vaddr;
+    insn_bits_t bits;
+    while (prog->fetch(pc, &bits)) {
+      insn_index_t index = insn_decode(bits);
+      if (index != INSN_UNKNOWN)
+        code[pc] = op_t{bits, &insn_decode_info[index]};
+      pc += insn_length(bits);
+    }
+  }
+}
+
+void translator_t::find_leaders()
+{
+  leaders.insert(prog->entry);
+  leaders.insert(prog->symbols.begin(), prog->symbols.end());
+
+  for (auto& c : code) {
+    reg_t pc = c.first;
+    insn_t insn(c.second.bits);
+    std::string name = c.second.info->name;
+
+    if (block_cache_t::is_cond_branch(insn.bits()))
+      leaders.insert(pc + insn.sb_imm());
+    else if (name == "j" || name == "jal")
+      leaders.insert(pc + insn.uj_imm());
+    else if (name == "c_beqz" || name == "c_bnez")
+      leaders.insert(pc + insn.rvc_b_imm());
+    else if (name == "c_j" || name == "c_jal")
+      leaders.insert(pc + insn.rvc_j_imm());
+
+    // Return addresses and the other side of branches.
+    if (block_cache_t::ends_block(insn.bits()))
+      leaders.insert(pc + insn.length());
+  }
+}
+
+void translator_t::emit_handler(FILE* out, const insn_decode_info_t* info)
+{
+  // Same body as insn_template.cc.
+  fprintf(out, "static inline reg_t aot_%s(processor_t* p, insn_t insn, reg_t pc)\n", info->name);
+  fprintf(out, "{\n");
+  fprintf(out, "  int xlen = AOT_XLEN;\n");
+  fprintf(out, "  reg_t npc = sext_xlen(pc + insn_length(UINT64_C(0x%" PRIx64 ")));\n", info->match);
+  fprintf(out, "  #include \"insns/%s.h\"\n", info->name);
+  fprintf(out, "  trace_opcode(p, UINT64_C(0x%" PRIx64 "), insn);\n", info->match);
+  fprintf(out, "  return npc;\n");
+  fprintf(out, "}\n\n");
+}
+
+// Emit the block at pc, which runs until a control transfer, an instruction
+// the simulator does not implement, or the next leader.  Returns its length.
+size_t translator_t::emit_block(FILE* out, reg_t pc, std::vector<op_t>* ops)
+{
+  ops->clear();
+  for (reg_t addr = pc; ops->size() < block_cache_t::MAX_BLOCK_INSNS; ) {
+    auto it = code.find(addr);
+    if (it == code.end())
+      break;
+    ops->push_back(it->second);
+    addr += insn_length(it->second.bits);
+    if (block_cache_t::ends_block(it->second.bits) || leaders.count(addr))
+      break;
+  }
+  if (ops->empty())
+    return 0;
+
+  reg_t start = sext(pc);
+  fprintf(out, "static const insn_bits_t bits_%" PRIx64 "[] = {\n", start);
+  for (auto& op : *ops)
+    fprintf(out, "  UINT64_C(0x%" PRIx64 "),\n", op.bits);
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "static reg_t block_%" PRIx64 "(processor_t* p, aot_frame_t* f)\n", start);
+  fprintf(out, "{\n");
+  if (ops->size() > 1)
+    fprintf(out, "  reg_t npc;\n");
+  reg_t addr = pc;
+  for (size_t k = 0; k < ops->size(); k++) {
+    op_t& op = (*ops)[k];
+    reg_t next = addr + insn_length(op.bits);
+    if (k + 1 < ops->size())
+      fprintf(out, "  AOT_OP(%zu, UINT64_C(0x%" PRIx64 "), %s, UINT64_C(0x%" PRIx64 "), UINT64_C(0x%" PRIx64 "))\n",
+              k, sext(addr), op.info->name, op.bits, sext(next));
+    else
+      fprintf(out, "  AOT_LAST(%zu, UINT64_C(0x%" PRIx64 "), %s, UINT64_C(0x%" PRIx64 "))\n",
+              k, sext(addr), op.info->name, op.bits);
+    addr = next;
+  }
+  fprintf(out, "}\n\n");
+  return ops->size();
+}
+
+void translator_t::run(FILE* out)
+{
+  decode();
+  find_leaders();
+
+  fprintf(out, "// Generated by lisc-aot.  Do not edit.\n\n");
+  fprintf(out, "#include \"insn_template.h\"\n");
+  fprintf(out, "#include \"aot.h\"\n\n");
+  fprintf(out, "#define AOT_XLEN %u\n\n", xlen);
+  // As in the shaped variants, the block loop takes illegal-instruction
+  // traps from the returned PC.
+  fprintf(out, "#undef raise_illegal_insn\n");
+  fprintf(out, "#define raise_illegal_insn() return PC_ILLEGAL_INSN\n\n");
+
+  std::set<const insn_decode_info_t*> used;
+  for (auto& c : code)
+    used.insert(c.second.info);
+  for (auto info : used)
+    emit_handler(out, info);
+
+  std::vector<std::pair<reg_t, std::vector<op_t>>> blocks;
+  std::vector<op_t> ops;
+  for (reg_t pc : leaders)
+    if (emit_block(out, pc, &ops))
+      blocks.push_back(std::make_pair(sext(pc), ops));
+
+  fprintf(out, "static const aot_block_desc_t blocks[] = {\n");
+  for (auto& b : blocks) {
+    bool flushes = block_cache_t::flushes_blocks(b.second.back().bits);
+    fprintf(out, "  {UINT64_C(0x%" PRIx64 "), block_%" PRIx64 ", %zu, %s, bits_%" PRIx64 "},\n",
+            b.first, b.first, b.second.size(), flushes ? "true" : "false", b.first);
+  }
+  fprintf(out, "};\n\n");
+  fprintf(out, "static aot_registration_t registration(blocks, sizeof(blocks) / sizeof(blocks[0]), AOT_XLEN);\n\n");
+
+  fprintf(out, "int main(int argc, char** argv)\n");
+  fprintf(out, "{\n");
+  fprintf(out, "  return aot_main(argc, argv);\n");
+  fprintf(out, "}\n");
+
+  fprintf(stderr, "lisc-aot: %zu blocks, %zu instructions decoded\n", blocks.size(), code.size());
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: lisc-aot [-o <output.cc>] <LISC ELF>\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  const char* out_fn = NULL;
+  const char* elf_fn = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      out_fn = argv[++i];
+    else if (argv[i][0] == '-' || elf_fn)
+      usage();
+    else
+      elf_fn = argv[i];
+  }
+  if (!elf_fn)
+    usage();
+
+  program_t prog;
+  if (!load_program(elf_fn, &prog)) {
+    fprintf(stderr, "lisc-aot: %s is not a well-formed little-endian ELF file\n", elf_fn);
+    return 1;
+  }
+#ifdef LISC32
+  if (prog.xlen != 32) {
+    fprintf(stderr, "lisc-aot: %s is a 64-bit ELF, but this is a LISC32 build\n", elf_fn);
+    return 1;
+  }
+#endif
+
+  FILE* out = out_fn ? fopen(out_fn, "w") : stdout;
+  if (!out) {
+    perror(out_fn);
+    return 1;
+  }
+
+  translator_t(&prog).run(out);
+
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
@@ -0,0 +1,244 @@
+// See LICENSE for license details.
+
+// Microbenchmark for the hart register file (see regfile_t in decode.h) and
+// the layout of the rest of the hart state (state_t in processor.h).  Runs
+// one stream of register-to-register writes, a quarter of them to x0, over
+// many harts, the way a host core running many harts sees them.
+//
+// The first pair of runs touches only pc and the integer registers: once
+// through regfile_t, which sends x0 writes to a sink slot and starts on a
+// cache line, and once through upstream's register file, which tests for
+// x0 and sits right after pc.  The second pair also does what every
+// instruction does to the rest of the hart (reads mstatus and serialized,
+// advances pc, and, in a commit log build, fills in log_reg_write), once on
+// state_t and once on upstream's state_t, which keeps those fields among
+// or after the CSRs.  A third run uses upstream's layout with regfile_t, to
+// tell the layout's share of the difference from the register file's.
+
+#include "decode.h"
+#include "processor.h"
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// regfile_t as upstream has it.
+template <class T, size_t N, bool zero_reg>
+class upstream_regfile_t
+{
+public:
+  void write(size_t i, T value)
+  {
+    if (!zero_reg || i != 0)
+      data[i] = value;
+  }
+  const T& operator [] (size_t i) const
+  {
+    return data[i];
+  }
+private:
+  T data[N];
+};
+
+struct upstream_hart_t
+{
+  reg_t pc;
+  upstream_regfile_t<reg_t, NXPR, true> XPR;
+};
+
+struct lisc_hart_t
+{
+  reg_t pc;
+  regfile_t<reg_t, NXPR, true> XPR;
+};
+
+// state_t as upstream lays it out, with either register file.
+template <template <class, size_t, bool> class regfile>
+struct upstream_state_t
+{
+  reg_t pc;
+  regfile<reg_t, NXPR, true> XPR;
+  regfile<freg_t, NFPR, false> FPR;
+  reg_t prv;
+  reg_t misa;
+  reg_t mstatus;
+  reg_t mepc;
+  reg_t mtval;
+  reg_t mscratch;
+  reg_t mtvec;
+  reg_t mcause;
+  reg_t minstret;
+  reg_t mie;
+  reg_t mip;
+  reg_t medeleg;
+  reg_t mideleg;
+  uint32_t mcounteren;
+  uint32_t scounteren;
+  reg_t sepc;
+  reg_t stval;
+  reg_t sscratch;
+  reg_t stvec;
+  reg_t satp;
+  reg_t scause;
+  reg_t dpc;
+  reg_t dscratch0, dscratch1;
+  dcsr_t dcsr;
+  reg_t tselect;
+  mcontrol_t mcontrol[state_t::num_triggers];
+  reg_t tdata2[state_t::num_triggers];
+  bool debug_mode;
+  uint8_t pmpcfg[state_t::n_pmp];
+  reg_t pmpaddr[state_t::n_pmp];
+  uint32_t fflags;
+  uint32_t frm;
+  bool serialized;
+  int single_step;
+#ifdef RISCV_ENABLE_COMMITLOG
+  commit_log_reg_t log_reg_write;
+  reg_t last_inst_priv;
+  int last_inst_xlen;
+  int last_inst_flen;
+#endif
+};
+
+struct write_t
+{
+  uint32_t hart;
+  uint8_t rd;
+  uint8_t rs1;
+};
+
+template<class hart_t>
+static hart_t* alloc_harts(size_t n)
+{
+  void* mem;
+  if (posix_memalign(&mem, REGFILE_ALIGN, n * sizeof(hart_t)) != 0) {
+    fprintf(stderr, "lisc-bench-regfile: out of memory\n");
+    exit(1);
+  }
+  memset(mem, 0, n * sizeof(hart_t));
+  return (hart_t*)mem;
+}
+
+// ns per write, and a sum of the registers so the writes can't be dropped.
+template<class hart_t>
+static double run(size_t nharts, const std::vector<write_t>& writes, int rounds, reg_t* sum)
+{
+  hart_t* harts = alloc_harts<hart_t>(nharts);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (auto& w : writes) {
+      auto& x = harts[w.hart].XPR;
+      x.write(w.rd, x[w.rs1] + 1);
+    }
+  }
+  std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - start;
+
+  *sum = 0;
+  for (size_t h = 0; h < nharts; h++)
+    for (size_t i = 0; i < NXPR; i++)
+      *sum += harts[h].XPR[i];
+  free(harts);
+  return t.count() / (double(rounds) * writes.size());
+}
+
+// The same, also touching the hart state around the register file as an
+// instruction does.
+template<class hart_t>
+static double run_state(size_t nharts, const std::vector<write_t>& writes, int rounds, reg_t* sum)
+{
+  hart_t* harts = alloc_harts<hart_t>(nharts);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (auto& w : writes) {
+      hart_t& h = harts[w.hart];
+      if (unlikely(h.serialized))
+        h.serialized = false;
+      reg_t value = h.XPR[w.rs1] + 1 + (h.mstatus & MSTATUS_FS);
+      h.XPR.write(w.rd, value);
+#ifdef RISCV_ENABLE_COMMITLOG
+      h.log_reg_write = (commit_log_reg_t){reg_t(w.rd) << 1, {value, 0}};
+#endif
+      h.pc += 4;
+    }
+  }
+  std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - start;
+
+  *sum = 0;
+  for (size_t h = 0; h < nharts; h++) {
+    *sum += harts[h].pc;
+    for (size_t i = 0; i < NXPR; i++)
+      *sum += harts[h].XPR[i];
+  }
+  free(harts);
+  return t.count() / (double(rounds) * writes.size());
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: lisc-bench-regfile [-h harts] [-w writes] [-r rounds]\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  size_t nharts = 1024, nwrites = 1 << 20;
+  int rounds = 20;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc)
+      usage();
+    if (strcmp(argv[i], "-h") == 0)
+      nharts = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-w") == 0)
+      nwrites = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-r") == 0)
+      rounds = atoi(argv[++i]);
+    else
+      usage();
+  }
+  if (nharts == 0 || nwrites == 0 || rounds <= 0)
+    usage();
+
+  // Each hart runs a few writes at a time, as it would between switches;
+  // a quarter of the writes are to x0, in no pattern a predictor can learn.
+  std::mt19937 rng(1);
+  std::vector<write_t> writes(nwrites);
+  uint32_t hart = 0;
+  for (auto& w : writes) {
+    if (rng() % 8 == 0)
+      hart = rng() % nharts;
+    w.hart = hart;
+    w.rd = rng() % 4 == 0 ? 0 : 1 + rng() % (NXPR - 1);
+    w.rs1 = rng() % NXPR;
+  }
+
+  typedef upstream_state_t<upstream_regfile_t> upstream_layout_t;
+  typedef upstream_state_t<regfile_t> upstream_layout_regfile_t;
+  reg_t upstream_sum, lisc_sum, upstream_state_sum, mixed_sum, state_sum;
+  double upstream_ns = run<upstream_hart_t>(nharts, writes, rounds, &upstream_sum);
+  double lisc_ns = run<lisc_hart_t>(nharts, writes, rounds, &lisc_sum);
+  double upstream_state_ns = run_state<upstream_layout_t>(nharts, writes, rounds, &upstream_state_sum);
+  double mixed_ns = run_state<upstream_layout_regfile_t>(nharts, writes, rounds, &mixed_sum);
+  double state_ns = run_state<state_t>(nharts, writes, rounds, &state_sum);
+  if (upstream_sum != lisc_sum || upstream_state_sum != state_sum || mixed_sum != state_sum) {
+    fprintf(stderr, "lisc-bench-regfile: the register files disagree\n");
+    return 1;
+  }
+
+  printf("%zu harts, %zu writes x %d rounds\n", nharts, nwrites, rounds);
+  printf("registers only:\n");
+  printf("  upstream (x0 test, after pc):   %6.2f ns/write\n", upstream_ns);
+  printf("  regfile_t (sink slot, aligned): %6.2f ns/write\n", lisc_ns);
+  printf("with the hot hart state:\n");
+  printf("  upstream state_t:               %6.2f ns/write (%zu bytes)\n",
+         upstream_state_ns, sizeof(upstream_layout_t));
+  printf("  upstream layout, regfile_t:     %6.2f ns/write (%zu bytes)\n",
+         mixed_ns, sizeof(upstream_layout_regfile_t));
+  printf("  state_t (hot fields together):  %6.2f ns/write (%zu bytes)\n",
+         state_ns, sizeof(state_t));
+  return 0;
+}
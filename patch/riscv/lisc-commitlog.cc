@@ -0,0 +1,64 @@
+// See LICENSE for license details.
+
+// Prints a binary commit log (commit_log.h) in the text format a
+// --enable-commitlog build prints to stderr.  With -m, instructions that
+// accessed memory also get the address and data.
+
+#include "commit_log.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage()
+{
+  fprintf(stderr, "usage: lisc-commitlog [-m] <log>\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  bool show_mem = false;
+  const char* fn = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-m") == 0)
+      show_mem = true;
+    else if (argv[i][0] == '-' || fn)
+      usage();
+    else
+      fn = argv[i];
+  }
+  if (!fn)
+    usage();
+
+  FILE* in = fopen(fn, "rb");
+  if (!in) {
+    perror(fn);
+    return 1;
+  }
+
+  commit_log_header_t h;
+  if (fread(&h, sizeof(h), 1, in) != 1 ||
+      memcmp(h.magic, COMMIT_LOG_MAGIC, sizeof(h.magic)) != 0 ||
+      h.record_size != sizeof(commit_log_record_t)) {
+    fprintf(stderr, "lisc-commitlog: %s is not a commit log from this version\n", fn);
+    return 1;
+  }
+
+  commit_log_record_t r;
+  while (fread(&r, sizeof(r), 1, in) == 1) {
+    printf("%1d 0x%016" PRIx64 " (0x%08" PRIx64 ")", r.prv, r.pc, r.insn);
+    if (r.reg)
+      printf(" %c%2d 0x%016" PRIx64, r.reg & 1 ? 'f' : 'x', r.reg >> 1, r.wdata);
+    if (show_mem && r.mem_size) {
+      uint64_t mask = r.mem_size == 8 ? ~uint64_t(0) : (uint64_t(1) << (r.mem_size * 8)) - 1;
+      printf(" %s 0x%016" PRIx64 " 0x%0*" PRIx64, r.mem_store ? "store" : "load",
+             r.mem_addr, r.mem_size * 2, r.mem_data & mask);
+    }
+    printf("\n");
+  }
+
+  fclose(in);
+  return 0;
+}
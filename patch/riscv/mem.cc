@@ -0,0 +1,96 @@
+// See LICENSE for license details.
+
+// Target memory.  Configured sizes are often far bigger than what a
+// program uses, so memory is reserved rather than allocated: pages come
+// from the kernel, zeroed, when first touched.  The reservation is aligned
+// to a huge page and marked for transparent huge pages, so the host TLB
+// covers touched memory in 2 MiB pieces where the kernel allows.  Parts of
+// it may be a program's pages mapped from its file (see program_map.cc).
+
+#include "devices.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define MEM_HUGE_PAGE (size_t(2) << 20)
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+mem_t::mem_t(size_t size) : len(size), file_backed(false)
+{
+  if (!size)
+    throw std::runtime_error("zero bytes of target memory requested");
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  mapped = (size + page - 1) / page * page;
+  size_t reserved = mapped + MEM_HUGE_PAGE;
+  char* p = (char*)mmap(NULL, reserved, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED)
+    throw std::runtime_error("couldn't allocate " + std::to_string(size) + " bytes of target memory");
+
+  // Trim the reservation to the aligned part.
+  data = (char*)(((uintptr_t)p + MEM_HUGE_PAGE - 1) & ~(MEM_HUGE_PAGE - 1));
+  if (data > p)
+    munmap(p, data - p);
+  if (p + reserved > data + mapped)
+    munmap(data + mapped, p + reserved - (data + mapped));
+
+#ifdef MADV_HUGEPAGE
+  madvise(data, mapped, MADV_HUGEPAGE); // a hint; fine if THP is off
+#endif
+}
+
+mem_t::~mem_t()
+{
+  munmap(data, mapped);
+}
+
+void mem_t::zero(size_t start, size_t n)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t end = start + n;
+  size_t first = (start + page - 1) / page * page;
+  size_t last = end == len ? mapped : end / page * page;
+
+  if (first < last && drop(first, last - first)) {
+    memset(data + start, 0, first - start);
+    memset(data + last, 0, end - std::min(end, last));
+    return;
+  }
+  memset(data + start, 0, n);
+}
+
+// Give back whole pages, which read as zero afterwards.
+bool mem_t::drop(size_t start, size_t n)
+{
+#ifdef __linux__
+  // Dropped private file pages would read as the file again, so once there
+  // are any the range is mapped afresh instead.
+  if (!file_backed)
+    return madvise(data + start, n, MADV_DONTNEED) == 0;
+  if (mmap(data + start, n, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+    return false;
+#ifdef MADV_HUGEPAGE
+  madvise(data + start, n, MADV_HUGEPAGE);
+#endif
+  return true;
+#else
+  // Elsewhere MADV_DONTNEED may keep the contents.
+  return false;
+#endif
+}
+
+bool mem_t::map_file(size_t start, size_t n, int fd, uint64_t file_off)
+{
+  if (mmap(data + start, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+           fd, file_off) == MAP_FAILED)
+    return false;
+  file_backed = true;
+  return true;
+}
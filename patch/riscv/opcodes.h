@@ -1,247 +1,125 @@
 #include "encoding.h"
+#include "insn_format.h"
 
 #define ZERO	0
 #define T0      5
 #define S0      8
 #define S1      9
 
-//获取到从lo到hi位置的bit数据
-static uint32_t bits(uint32_t value, unsigned int hi, unsigned int lo) {
-  return (value >> lo) & ((1 << (hi+1-lo)) - 1);
-}
-
-static uint32_t bit(uint32_t value, unsigned int b) {
-  return (value >> b) & 1;
-}
+// Encoders for the instructions the debug module writes into its abstract
+// command buffer.  Field positions come from insn_format.h, the same place
+// insn_t decodes them from.
 
+// LISC has no rd field in j/jal: jal always links to ra, so rd only picks
+// which of the two to emit.
 static uint32_t jal(unsigned int rd, uint32_t imm) __attribute__ ((unused));
 static uint32_t jal(unsigned int rd, uint32_t imm) {
-  return (bits(imm, 19,5) << 13) |
-    (bit(imm, 20) << 12) |
-    (bits(imm, 4,1 ) << 8) |
-    MATCH_JAL;
+  return insn_uj_format_t::encode(rd == ZERO ? MATCH_J : MATCH_JAL, 0, 0, 0, int32_t(imm));
 }
 
 static uint32_t csrsi(unsigned int csr, uint16_t imm) __attribute__ ((unused));
 static uint32_t csrsi(unsigned int csr, uint16_t imm) {
-  return (csr << 12) |
-    (bits(imm, 4, 0) << 24) |
-    MATCH_CSRRSI;
+  return insn_csr_field_t::encode(csr) | insn_zimm_field_t::encode(imm) | MATCH_CSRRSI;
 }
 
-static uint32_t sw(unsigned int src, unsigned int base, uint16_t offset) __attribute__ ((unused));
-static uint32_t sw(unsigned int src, unsigned int base, uint16_t offset)
-{
-  return (bits(offset, 11, 4) << 12) |
-    (src << 24) |
-    (base << 20) |
-    (bits(offset, 3, 0) << 8) |
-    MATCH_SW;
+static uint32_t csrci(unsigned int csr, uint16_t imm) __attribute__ ((unused));
+static uint32_t csrci(unsigned int csr, uint16_t imm) {
+  return insn_csr_field_t::encode(csr) | insn_zimm_field_t::encode(imm) | MATCH_CSRRCI;
 }
 
-/*
-static uint32_t sd(unsigned int src, unsigned int base, uint16_t offset) __attribute__ ((unused));
-static uint32_t sd(unsigned int src, unsigned int base, uint16_t offset)
+static uint32_t sw(unsigned int src, unsigned int base, uint16_t offset) __attribute__ ((unused));
+static uint32_t sw(unsigned int src, unsigned int base, uint16_t offset)
 {
-  return (bits(offset, 11, 5) << 25) |
-    (src << 20) |
-    (base << 15) |
-    (bits(offset, 4, 0) << 7) |
-    MATCH_SD;
+  return insn_s_format_t::encode(MATCH_SW, 0, base, src, int16_t(offset));
 }
-*/
 
 static uint32_t sh(unsigned int src, unsigned int base, uint16_t offset) __attribute__ ((unused));
 static uint32_t sh(unsigned int src, unsigned int base, uint16_t offset)
 {
-  return (bits(offset, 11, 4) << 12) |
-    (src << 24) |
-    (base << 20) |
-    (bits(offset, 3, 0) << 8) |
-    MATCH_SH;
+  return insn_s_format_t::encode(MATCH_SH, 0, base, src, int16_t(offset));
 }
 
 static uint32_t sb(unsigned int src, unsigned int base, uint16_t offset) __attribute__ ((unused));
 static uint32_t sb(unsigned int src, unsigned int base, uint16_t offset)
 {
-  return (bits(offset, 11, 4) << 12) |
-    (src << 24) |
-    (base << 20) |
-    (bits(offset, 3, 0) << 8) |
-    MATCH_SB;
-}
-/*
-static uint32_t ld(unsigned int rd, unsigned int base, uint16_t offset) __attribute__ ((unused));
-static uint32_t ld(unsigned int rd, unsigned int base, uint16_t offset)
-{
-  return (bits(offset, 11, 0) << 20) |
-    (base << 15) |
-    (bits(rd, 4, 0) << 7) |
-    MATCH_LD;
+  return insn_s_format_t::encode(MATCH_SB, 0, base, src, int16_t(offset));
 }
-*/
+
 static uint32_t lw(unsigned int rd, unsigned int base, uint16_t offset) __attribute__ ((unused));
 static uint32_t lw(unsigned int rd, unsigned int base, uint16_t offset)
 {
-  return (bits(offset, 11, 0) << 12) |
-    (base << 24) |
-    (bits(rd, 3, 0) << 8) |
-    MATCH_LW;
+  return insn_i_format_t::encode(MATCH_LW, rd, base, 0, int16_t(offset));
 }
 
 static uint32_t lh(unsigned int rd, unsigned int base, uint16_t offset) __attribute__ ((unused));
 static uint32_t lh(unsigned int rd, unsigned int base, uint16_t offset)
 {
-  return (bits(offset, 11, 0) << 12) |
-    (base << 24) |
-    (bits(rd, 3, 0) << 8) |
-    MATCH_LH;
+  return insn_i_format_t::encode(MATCH_LH, rd, base, 0, int16_t(offset));
 }
 
 static uint32_t lb(unsigned int rd, unsigned int base, uint16_t offset) __attribute__ ((unused));
 static uint32_t lb(unsigned int rd, unsigned int base, uint16_t offset)
 {
-  return (bits(offset, 11, 0) << 12) |
-    (base << 24) |
-    (bits(rd, 3, 0) << 8) |
-    MATCH_LB;
+  return insn_i_format_t::encode(MATCH_LB, rd, base, 0, int16_t(offset));
 }
 
 static uint32_t csrw(unsigned int source, unsigned int csr) __attribute__ ((unused));
 static uint32_t csrw(unsigned int source, unsigned int csr) {
-  return (csr << 12) | (source << 24) | MATCH_CSRRW;
-}
-
-static uint32_t addi(unsigned int dest, unsigned int src, uint16_t imm) __attribute__ ((unused));
-static uint32_t addi(unsigned int dest, unsigned int src, uint16_t imm)
-{
-  return (bits(imm, 11, 0) << 12) |
-    (src << 24) |
-    (dest << 8) |
-    MATCH_ADDI;
+  return insn_csr_field_t::encode(csr) | insn_rs1_field_t::encode(source) | MATCH_CSRRW;
 }
 
 static uint32_t csrr(unsigned int rd, unsigned int csr) __attribute__ ((unused));
 static uint32_t csrr(unsigned int rd, unsigned int csr) {
-  return (csr << 12) | (rd << 8) | MATCH_CSRRS;
-}
-/*
-static uint32_t fsw(unsigned int src, unsigned int base, uint16_t offset) __attribute__ ((unused));
-static uint32_t fsw(unsigned int src, unsigned int base, uint16_t offset)
-{
-  return (bits(offset, 11, 5) << 25) |
-    (bits(src, 4, 0) << 20) |
-    (base << 15) |
-    (bits(offset, 4, 0) << 7) |
-    MATCH_FSW;
-}
-
-static uint32_t fsd(unsigned int src, unsigned int base, uint16_t offset) __attribute__ ((unused));
-static uint32_t fsd(unsigned int src, unsigned int base, uint16_t offset)
-{
-  return (bits(offset, 11, 5) << 25) |
-    (bits(src, 4, 0) << 20) |
-    (base << 15) |
-    (bits(offset, 4, 0) << 7) |
-    MATCH_FSD;
-}
-
-static uint32_t flw(unsigned int dest, unsigned int base, uint16_t offset) __attribute__ ((unused));
-static uint32_t flw(unsigned int dest, unsigned int base, uint16_t offset)
-{
-  return (bits(offset, 11, 0) << 20) |
-    (base << 15) |
-    (bits(dest, 4, 0) << 7) |
-    MATCH_FLW;
-}
-
-static uint32_t fld(unsigned int dest, unsigned int base, uint16_t offset) __attribute__ ((unused));
-static uint32_t fld(unsigned int dest, unsigned int base, uint16_t offset)
-{
-  return (bits(offset, 11, 0) << 20) |
-    (base << 15) |
-    (bits(dest, 4, 0) << 7) |
-    MATCH_FLD;
-}
-*/
-static uint32_t ebreak(void) __attribute__ ((unused));
-static uint32_t ebreak(void) { return MATCH_EBREAK; }
-/*
-static uint32_t ebreak_c(void) __attribute__ ((unused));
-static uint32_t ebreak_c(void) { return MATCH_C_EBREAK; }
-*/
-/*
-static uint32_t dret(void) __attribute__ ((unused));
-static uint32_t dret(void) { return MATCH_DRET; }
-*/
-static uint32_t fence_i(void) __attribute__ ((unused));
-static uint32_t fence_i(void)
-{
-  return MATCH_FENCE_I;
+  return insn_csr_field_t::encode(csr) | insn_rd_field_t::encode(rd) | MATCH_CSRRS;
 }
 
-/*
-static uint32_t lui(unsigned int dest, uint32_t imm) __attribute__ ((unused));
-static uint32_t lui(unsigned int dest, uint32_t imm)
+static uint32_t addi(unsigned int dest, unsigned int src, uint16_t imm) __attribute__ ((unused));
+static uint32_t addi(unsigned int dest, unsigned int src, uint16_t imm)
 {
-  return (bits(imm, 19, 0) << 12) |
-    (dest << 7) |
-    MATCH_LUI;
-}
-
-static uint32_t csrci(unsigned int csr, uint16_t imm) __attribute__ ((unused));
-static uint32_t csrci(unsigned int csr, uint16_t imm) {
-  return (csr << 20) |
-    (bits(imm, 4, 0) << 15) |
-    MATCH_CSRRCI;
+  return insn_i_format_t::encode(MATCH_ADDI, dest, src, 0, int16_t(imm));
 }
 
 static uint32_t li(unsigned int dest, uint16_t imm) __attribute__ ((unused));
 static uint32_t li(unsigned int dest, uint16_t imm)
 {
-	return addi(dest, 0, imm);
+  return addi(dest, 0, imm);
 }
 
-static uint32_t fsd(unsigned int src, unsigned int base, uint16_t offset) __attribute__ ((unused));
-static uint32_t fsd(unsigned int src, unsigned int base, uint16_t offset)
+static uint32_t nop(void) __attribute__ ((unused));
+static uint32_t nop(void)
 {
-  return (bits(offset, 11, 5) << 25) |
-    (bits(src, 4, 0) << 20) |
-    (base << 15) |
-    (bits(offset, 4, 0) << 7) |
-    MATCH_FSD;
+  return addi(0, 0, 0);
 }
 
 static uint32_t ori(unsigned int dest, unsigned int src, uint16_t imm) __attribute__ ((unused));
 static uint32_t ori(unsigned int dest, unsigned int src, uint16_t imm)
 {
-  return (bits(imm, 11, 0) << 20) |
-    (src << 15) |
-    (dest << 7) |
-    MATCH_ORI;
+  return insn_i_format_t::encode(MATCH_ORI, dest, src, 0, int16_t(imm));
 }
 
-static uint32_t nop(void) __attribute__ ((unused));
-static uint32_t nop(void)
-{
-  return addi(0, 0, 0);
-}
-*/
-
 static uint32_t xori(unsigned int dest, unsigned int src, uint16_t imm) __attribute__ ((unused));
 static uint32_t xori(unsigned int dest, unsigned int src, uint16_t imm)
 {
-  return (bits(imm, 11, 0) << 12) |
-    (src << 24) |
-    (dest << 8) |
-    MATCH_XORI;
+  return insn_i_format_t::encode(MATCH_XORI, dest, src, 0, int16_t(imm));
 }
 
 static uint32_t srli(unsigned int dest, unsigned int src, uint8_t shamt) __attribute__ ((unused));
 static uint32_t srli(unsigned int dest, unsigned int src, uint8_t shamt)
 {
-	return (bits(shamt, 7, 0) << 16) |
-		(src << 24) |
-		(dest << 8) |
-		MATCH_SRLI;
+  return insn_shamt_field_t::encode(shamt) | insn_i_format_t::encode(MATCH_SRLI, dest, src, 0, 0);
+}
+
+static uint32_t lui(unsigned int dest, uint32_t imm) __attribute__ ((unused));
+static uint32_t lui(unsigned int dest, uint32_t imm)
+{
+  return insn_u_format_t::encode(MATCH_LUI, dest, 0, 0, int32_t(imm << 12));
+}
+
+static uint32_t ebreak(void) __attribute__ ((unused));
+static uint32_t ebreak(void) { return MATCH_EBREAK; }
+
+static uint32_t fence_i(void) __attribute__ ((unused));
+static uint32_t fence_i(void)
+{
+  return MATCH_FENCE_I;
 }
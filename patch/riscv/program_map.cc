@@ -0,0 +1,100 @@
+// See LICENSE for license details.
+
+// Copy-on-write program loading.  fesvr loads a program by writing every
+// byte of every segment into target memory through write_chunk().  Before
+// it does, map_program() maps the whole pages of each loadable segment
+// straight from the ELF file into target memory, privately, so fesvr's
+// writes find their bytes already there and write_chunk() leaves them
+// alone: the pages stay shared with the page cache until the program
+// stores to them, and .bss stays untouched.  fesvr still writes whatever
+// isn't mapped (pages at segment edges, segments outside RAM, files this
+// can't read), so nothing depends on the mapping having worked.
+//
+// The mapped pages read whatever the file holds until they are written,
+// so don't rewrite a program while it runs.
+
+#include "sim.h"
+#include <string>
+#include <vector>
+#include <elf.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+struct segment_t
+{
+  uint64_t paddr;
+  uint64_t offset;
+  uint64_t filesz;
+};
+
+template<class Ehdr, class Phdr>
+static std::vector<segment_t> read_segments(int fd)
+{
+  std::vector<segment_t> segments;
+  Ehdr eh;
+  if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) || eh.e_phentsize != sizeof(Phdr))
+    return segments;
+
+  std::vector<Phdr> ph(eh.e_phnum);
+  ssize_t size = ph.size() * sizeof(Phdr);
+  if (pread(fd, ph.data(), size, eh.e_phoff) != size)
+    return segments;
+
+  for (auto& p : ph)
+    if (p.p_type == PT_LOAD && p.p_filesz > 0)
+      segments.push_back(segment_t{p.p_paddr, p.p_offset, p.p_filesz});
+  return segments;
+}
+
+// htif_t keeps the program's path to itself; it is the first argument that
+// is not an option.
+static std::string program_path(const std::vector<std::string>& args)
+{
+  for (auto& a : args)
+    if (!a.empty() && a[0] != '+' && a[0] != '-')
+      return a;
+  return "";
+}
+
+void sim_t::map_program()
+{
+  std::string path = program_path(htif_args);
+  int fd = path.empty() ? -1 : open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  unsigned char ident[EI_NIDENT];
+  std::vector<segment_t> segments;
+  if (pread(fd, ident, sizeof(ident), 0) == sizeof(ident) &&
+      memcmp(ident, ELFMAG, SELFMAG) == 0 && ident[EI_DATA] == ELFDATA2LSB) {
+    if (ident[EI_CLASS] == ELFCLASS32)
+      segments = read_segments<Elf32_Ehdr, Elf32_Phdr>(fd);
+    else if (ident[EI_CLASS] == ELFCLASS64)
+      segments = read_segments<Elf64_Ehdr, Elf64_Phdr>(fd);
+  }
+
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  for (auto& s : segments) {
+    size_t start;
+    mem_t* mem = find_mem(s.paddr, &start);
+    if (!mem || mem->size() - start < s.filesz)
+      continue;
+    // The file and memory offsets must share their place in a page.
+    if ((start - s.offset) % page != 0)
+      continue;
+
+    uint64_t skip = (page - start % page) % page;
+    uint64_t len = s.filesz > skip ? (s.filesz - skip) / page * page : 0;
+    if (len)
+      mem->map_file(start + skip, len, fd, s.offset + skip);
+  }
+
+  close(fd); // the mappings keep the file
+}
+
+void sim_t::load_program()
+{
+  map_program();
+  htif_t::load_program();
+}
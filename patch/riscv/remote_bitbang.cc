@@ -0,0 +1,239 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "remote_bitbang.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/////////// remote_bitbang_t
+
+remote_bitbang_t::remote_bitbang_t(uint16_t port, jtag_dtm_t *tap) :
+  tap(tap),
+  client_fd(-1),
+  stop(false),
+  hangup(false),
+  pending(false)
+{
+  socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (socket_fd == -1) {
+    fprintf(stderr, "remote_bitbang failed to make socket: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  int reuseaddr = 1;
+  if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr,
+        sizeof(int)) == -1) {
+    fprintf(stderr, "remote_bitbang failed setsockopt: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(port);
+
+  if (bind(socket_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "remote_bitbang failed to bind socket: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  if (listen(socket_fd, 1) == -1) {
+    fprintf(stderr, "remote_bitbang failed to listen on socket: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(socket_fd, (struct sockaddr *) &addr, &addrlen) == -1) {
+    fprintf(stderr, "remote_bitbang getsockname failed: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  if (pipe(wake_fds) == -1) {
+    fprintf(stderr, "remote_bitbang failed to make pipe: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  printf("Listening for remote bitbang connection on port %d.\n",
+      ntohs(addr.sin_port));
+  fflush(stdout);
+
+  io = std::thread(&remote_bitbang_t::serve, this);
+}
+
+remote_bitbang_t::~remote_bitbang_t()
+{
+  stop.store(true);
+  wake();
+  io.join();
+
+  if (client_fd >= 0)
+    close(client_fd);
+  close(socket_fd);
+  close(wake_fds[0]);
+  close(wake_fds[1]);
+}
+
+void remote_bitbang_t::wake()
+{
+  char c = 0;
+  while (write(wake_fds[1], &c, 1) == -1 && errno == EINTR)
+    ;
+}
+
+// The I/O thread.  Accepts one client at a time and queues everything it
+// sends.  Once the client hangs up, it waits for tick() to close it before
+// listening again, so the simulator never sends to a recycled descriptor.
+void remote_bitbang_t::serve()
+{
+  static const size_t buf_size = 64 * 1024;
+  char buf[buf_size];
+  bool waiting_for_close = false;
+
+  while (!stop.load()) {
+    struct pollfd fds[2];
+    nfds_t n = 0;
+    fds[n].fd = wake_fds[0];
+    fds[n++].events = POLLIN;
+
+    int fd = client_fd.load();
+    if (fd < 0)
+      waiting_for_close = false;
+    if (!waiting_for_close) {
+      fds[n].fd = fd >= 0 ? fd : socket_fd;
+      fds[n++].events = POLLIN;
+    }
+
+    if (poll(fds, n, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "remote_bitbang poll failed: %s (%d)\n",
+          strerror(errno), errno);
+      abort();
+    }
+
+    if (fds[0].revents) {
+      char c;
+      if (read(wake_fds[0], &c, 1) == -1 && errno != EINTR)
+        abort();
+    }
+    if (n < 2 || !fds[1].revents)
+      continue;
+
+    if (fd < 0) {
+      fd = accept(socket_fd, NULL, NULL);
+      if (fd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          fprintf(stderr, "failed to accept on socket: %s (%d)\n",
+              strerror(errno), errno);
+          abort();
+        }
+        continue;
+      }
+      client_fd.store(fd);
+      continue;
+    }
+
+    ssize_t got = read(fd, buf, buf_size);
+    if (got == -1 && (errno == EAGAIN || errno == EINTR))
+      continue;
+
+    std::lock_guard<std::mutex> lock(recv_lock);
+    if (got > 0) {
+      recv_buf.append(buf, got);
+    } else {
+      hangup = true;
+      waiting_for_close = true;
+    }
+    pending.store(true, std::memory_order_release);
+  }
+}
+
+void remote_bitbang_t::tick()
+{
+  if (!pending.load(std::memory_order_acquire))
+    return;
+
+  bool closing;
+  {
+    std::lock_guard<std::mutex> lock(recv_lock);
+    commands.swap(recv_buf);
+    recv_buf.clear();
+    closing = hangup;
+    hangup = false;
+    pending.store(false, std::memory_order_relaxed);
+  }
+
+  execute_commands();
+
+  if (closing) {
+    fprintf(stderr, "Remote end disconnected\n");
+    close(client_fd.exchange(-1));
+    wake();
+  }
+}
+
+void remote_bitbang_t::execute_commands()
+{
+  int fd = client_fd.load();
+  bool quit = false;
+  send_buf.clear();
+
+  for (char command : commands) {
+    if (quit)
+      break;
+
+    bool tck, tms, tdi;
+    switch (command) {
+      case 'B': /* fprintf(stderr, "*BLINK*\n"); */ continue;
+      case 'b': /* fprintf(stderr, "_______\n"); */ continue;
+      case 'r': tap->reset(); continue;
+      case '0': tck = 0; tms = 0; tdi = 0; break;
+      case '1': tck = 0; tms = 0; tdi = 1; break;
+      case '2': tck = 0; tms = 1; tdi = 0; break;
+      case '3': tck = 0; tms = 1; tdi = 1; break;
+      case '4': tck = 1; tms = 0; tdi = 0; break;
+      case '5': tck = 1; tms = 0; tdi = 1; break;
+      case '6': tck = 1; tms = 1; tdi = 0; break;
+      case '7': tck = 1; tms = 1; tdi = 1; break;
+      case 'R': send_buf += tap->tdo() ? '1' : '0'; continue;
+      case 'Q': quit = true; continue;
+      default:
+        fprintf(stderr, "remote_bitbang got unsupported command '%c'\n",
+            command);
+        continue;
+    }
+    tap->set_pins(tck, tms, tdi);
+  }
+  commands.clear();
+
+  // All the replies to one batch of commands go out together.
+  for (size_t sent = 0; sent < send_buf.size(); ) {
+    ssize_t n = send(fd, send_buf.data() + sent, send_buf.size() - sent, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      // The I/O thread will see the hangup.
+      break;
+    }
+    sent += n;
+  }
+
+  // The I/O thread sees this as a hangup, and tick() then closes it.
+  if (quit)
+    shutdown(fd, SHUT_RDWR);
+}
@@ -0,0 +1,53 @@
+#ifndef REMOTE_BITBANG_H
+#define REMOTE_BITBANG_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "jtag_dtm.h"
+
+// The socket is read by an I/O thread that sleeps in poll() until a
+// debugger connects or sends something; tick() runs whatever has arrived,
+// all of it at once, on the simulator thread.
+class remote_bitbang_t
+{
+public:
+  // Create a new server, listening for connections from localhost on the given port.
+  remote_bitbang_t(uint16_t port, jtag_dtm_t *tap);
+  ~remote_bitbang_t();
+
+  // Execute the commands received since the last call.  Costs one atomic
+  // load when there are none.
+  void tick();
+  // A debugger is connected.
+  bool connected() const { return client_fd.load(std::memory_order_relaxed) >= 0; }
+
+private:
+  jtag_dtm_t *tap;
+
+  int socket_fd;
+  // Opened by the I/O thread, closed by the simulator thread.
+  std::atomic<int> client_fd;
+  // Any byte makes the I/O thread look at client_fd and stop again.
+  int wake_fds[2];
+  std::atomic<bool> stop;
+  std::thread io;
+
+  std::mutex recv_lock;
+  std::string recv_buf;         // received, not yet executed
+  bool hangup;                  // the client has gone; close it after recv_buf
+  std::atomic<bool> pending;    // recv_buf or hangup is worth a look
+
+  // Only touched by the simulator thread.
+  std::string commands;
+  std::string send_buf;
+
+  void serve();
+  void wake();
+  void execute_commands();
+};
+
+#endif
@@ -2,17 +2,24 @@
 
 #include "sim.h"
 #include "mmu.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "aot.h"
+#include "commit_log.h"
+#include "hart_pool.h"
 #include "remote_bitbang.h"
+#include "fdt.h"
+#include "checkpoint.h"
 #include <map>
+#include <new>
+#include <algorithm>
 #include <iostream>
-#include <sstream>
 #include <climits>
+#include <cinttypes>
 #include <cstdlib>
-#include <cassert>
+#include <cstring>
+#include <cerrno>
 #include <signal.h>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <sys/types.h>
 
 volatile bool ctrlc_pressed = false;
 static void handle_signal(int sig)
@@ -23,14 +30,29 @@ static void handle_signal(int sig)
   signal(sig, &handle_signal);
 }
 
+// processor_t holds a cache-line-aligned register file (see regfile_t), and
+// plain new does not honour that alignment before C++17.
+static processor_t* new_processor(const char* isa, sim_t* sim, uint32_t id, bool halted)
+{
+  void* mem;
+  if (posix_memalign(&mem, alignof(processor_t), sizeof(processor_t)) != 0)
+    throw std::bad_alloc();
+  return new (mem) processor_t(isa, sim, id, halted);
+}
+
 sim_t::sim_t(const char* isa, size_t nprocs, bool halted, reg_t start_pc,
              std::vector<std::pair<reg_t, mem_t*>> mems,
              const std::vector<std::string>& args,
              std::vector<int> const hartids, unsigned progsize,
              unsigned max_bus_master_bits, bool require_authentication)
   : htif_t(args), mems(mems), procs(std::max(nprocs, size_t(1))),
-    start_pc(start_pc), current_step(0), current_proc(0), debug(false),
-    remote_bitbang(NULL),
+    start_pc(start_pc), quantum(INTERLEAVE), preferred_quantum(INTERLEAVE),
+    current_step(0), current_proc(0), round_mmio(0), round_htif(0),
+    quantum_stats(), quantum_stats_enabled(false),
+    clint_ticks(0), clint_event(0), snapshot_save_at(0), executed_steps(0),
+    checkpoint_interval(0), checkpoint_keep(0), host_steps(0), debug(false),
+    block_mode(true), aot(NULL), hart_quantum(INTERLEAVE), hart_steps(0),
+    remote_bitbang(NULL), htif_args(args),
     debug_module(this, progsize, max_bus_master_bits, require_authentication)
 {
   signal(SIGINT, &handle_signal);
@@ -44,7 +66,7 @@ sim_t::sim_t(const char* isa, size_t nprocs, bool halted, reg_t start_pc,
 
   if (hartids.size() == 0) {
     for (size_t i = 0; i < procs.size(); i++) {
-      procs[i] = new processor_t(isa, this, i, halted);
+      procs[i] = new_processor(isa, this, i, halted);
     }
   }
   else {
@@ -53,18 +75,41 @@ sim_t::sim_t(const char* isa, size_t nprocs, bool halted, reg_t start_pc,
       exit(1);
     }
     for (size_t i = 0; i < procs.size(); i++) {
-      procs[i] = new processor_t(isa, this, hartids[i], halted);
+      procs[i] = new_processor(isa, this, hartids[i], halted);
+    }
+  }
+
+#ifdef LISC32
+  // The register file and sext_xlen() are fixed at 32 bits in this build.
+  for (size_t i = 0; i < procs.size(); i++) {
+    if (procs[i]->get_max_xlen() != 32) {
+      std::cerr << "This simulator was built for LISC32 and only runs RV32 ISAs (got " << isa << ")" << std::endl;
+      exit(1);
     }
   }
+#endif
+
+  for (size_t i = 0; i < procs.size(); i++)
+    block_caches.emplace_back(new block_cache_t(procs[i]));
+  in_wfi.resize(procs.size());
+  if (aot_table_t::registered().usable(procs[0]))
+    aot = &aot_table_t::registered();
 
   clint.reset(new clint_t(procs));
   bus.add_device(CLINT_BASE, clint.get());
+  schedule_clint();
 }
 
 sim_t::~sim_t()
 {
-  for (size_t i = 0; i < procs.size(); i++)
-    delete procs[i];
+  hart_pool.reset();
+  dirty_pages.reset();
+  if (quantum_stats_enabled)
+    print_quantum_stats();
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->~processor_t();
+    free(procs[i]);
+  }
   delete debug_mmu;
 }
 
@@ -83,7 +128,7 @@ void sim_t::main()
     if (debug || ctrlc_pressed)
       interactive();
     else
-      step(INTERLEAVE);
+      step(quantum);
     if (remote_bitbang) {
       remote_bitbang->tick();
     }
@@ -99,26 +144,476 @@ int sim_t::run()
 
 void sim_t::step(size_t n)
 {
+  // Only from a point where the serial loop would also be between rounds.
+  if (hart_pool && current_step == 0 && current_proc == 0 && can_step_parallel()) {
+    step_parallel(n);
+    return;
+  }
+
   for (size_t i = 0, steps = 0; i < n; i += steps)
   {
-    steps = std::min(n - i, INTERLEAVE - current_step);
-    procs[current_proc]->step(steps);
+    steps = std::min(n - i, quantum - current_step);
+    if (block_mode) {
+      step_blocks(current_proc, steps);
+    } else {
+      sync_mip(current_proc);
+      procs[current_proc]->step(steps);
+    }
 
     current_step += steps;
-    if (current_step == INTERLEAVE)
+    executed_steps += steps;
+    if (current_step == quantum)
     {
       current_step = 0;
       procs[current_proc]->yield_load_reservation();
       if (++current_proc == procs.size()) {
         current_proc = 0;
-        clint->increment(INTERLEAVE / INSNS_PER_RTC_TICK);
+        events.advance(events.now() + quantum);
+        fast_forward_idle();
+        adapt_quantum();
+        check_snapshot();
+        check_checkpoint();
       }
 
-      host->switch_to();
+      host_turn();
     }
   }
 }
 
+// Anything that is not safe to do from several threads at once: a
+// debugger, printed or binary logs and the histogram.  Checkpoints are
+// only any use if running again from one does the same thing.
+bool sim_t::can_step_parallel()
+{
+  return !debug && !log && !histogram_enabled && !commit_log && !checkpoint_interval &&
+         !(remote_bitbang && remote_bitbang->connected());
+}
+
+// Like step(), but the harts run their share of each round at the same time
+// on the hart pool.  The barrier at the end of a quantum stands in for the
+// end of a round: time advances and load reservations are dropped there,
+// while no hart is running.
+void sim_t::step_parallel(size_t n)
+{
+  for (size_t i = 0; i < n; i += hart_steps) {
+    hart_steps = std::min(std::min(n - i, hart_quantum), steps_to_next_event());
+    hart_pool->run();
+    executed_steps += hart_steps * procs.size();
+    quantum_stats.rounds++;
+    quantum_stats.sizes[hart_steps]++;
+
+    for (auto p : procs)
+      p->yield_load_reservation();
+    events.advance(events.now() + hart_steps);
+    fast_forward_idle();
+    check_snapshot();
+  }
+
+  host->switch_to();
+}
+
+// A round is one quantum of every hart.  Long quanta save host switches
+// and block loop entries; short ones let devices, the host and a debugger
+// see the harts more often.  So a lone hart that talks to no one gets
+// twice the quantum each round; device accesses or host traffic halve it;
+// several running harts, which may be talking through memory where no
+// device sees it, drift back to INTERLEAVE; and a debugger pins it at
+// MIN_INTERLEAVE.  Whatever it wants, a round ends at the next event.
+void sim_t::adapt_quantum()
+{
+  quantum_stats.rounds++;
+  quantum_stats.sizes[quantum]++;
+
+  size_t current = preferred_quantum;
+  size_t running = 0;
+  for (auto p : procs)
+    running += !p->halted();
+
+  size_t next;
+  if (debug || (remote_bitbang && remote_bitbang->connected()))
+    next = MIN_INTERLEAVE;
+  else if (round_mmio || round_htif)
+    next = current / 2;
+  else if (running <= 1)
+    next = current * 2;
+  else if (current > INTERLEAVE)
+    next = current / 2 < INTERLEAVE ? INTERLEAVE : current / 2;
+  else
+    next = current * 2 > INTERLEAVE ? INTERLEAVE : current * 2;
+
+  if (next < MIN_INTERLEAVE)
+    next = MIN_INTERLEAVE;
+  if (next > MAX_INTERLEAVE)
+    next = MAX_INTERLEAVE;
+  // Whole timer ticks, so the CLINT sees the same time it would have.
+  next = next / INSNS_PER_RTC_TICK * INSNS_PER_RTC_TICK;
+
+  quantum_stats.grown += next > current;
+  quantum_stats.shrunk += next < current;
+  preferred_quantum = next;
+  quantum = std::min(next, steps_to_next_event());
+  round_mmio = 0;
+  round_htif = 0;
+}
+
+static bool wakes_from_wfi(processor_t* p)
+{
+  state_t* state = p->get_state();
+  return (state->mip & state->mie) || p->halt_request;
+}
+
+// With every hart stalled in wfi nothing can happen before the next event,
+// such as a timer interrupt, so go straight to it.  The host still gets its
+// turn every round, so HTIF input is not held up.
+void sim_t::fast_forward_idle()
+{
+  for (size_t i = 0; i < procs.size(); i++)
+    sync_mip(i);
+  for (size_t i = 0; i < procs.size(); i++)
+    if (!in_wfi[i] || wakes_from_wfi(procs[i]))
+      return;
+
+  uint64_t next = events.next_deadline();
+  // Nothing scheduled: only the host can wake them, so let time run as usual.
+  if (next == UINT64_MAX)
+    return;
+
+  quantum_stats.idle_jumps++;
+  quantum_stats.idle_ticks += (next - events.now()) / INSNS_PER_RTC_TICK;
+  events.advance(next);
+}
+
+size_t sim_t::steps_to_next_event()
+{
+  uint64_t next = events.next_deadline();
+  if (next == UINT64_MAX)
+    return SIZE_MAX;
+  uint64_t ticks = (next - events.now() + INSNS_PER_RTC_TICK - 1) / INSNS_PER_RTC_TICK;
+  return std::max(ticks, uint64_t(1)) * INSNS_PER_RTC_TICK;
+}
+
+// The CLINT's time only moves when a hart or the host touches it, or when
+// one of its compare registers comes due; its timer interrupts are raised
+// then and only then.
+void sim_t::sync_clint()
+{
+  uint64_t ticks = events.now() / INSNS_PER_RTC_TICK;
+  clint->increment(ticks - clint_ticks);
+  clint_ticks = ticks;
+}
+
+// The CLINT never writes a hart's mip, since the hart may be running on
+// another thread; the hart copies its bits in here, before it looks for
+// interrupts.  Only from the thread running hart i, or between rounds.
+void sim_t::sync_mip(size_t i)
+{
+  state_t* state = procs[i]->get_state();
+  state->mip = (state->mip & ~reg_t(MIP_MSIP | MIP_MTIP)) | clint->mip(i);
+}
+
+void sim_t::schedule_clint()
+{
+  events.cancel(clint_event);
+  clint_event = 0;
+
+  uint64_t mtime, wait = UINT64_MAX;
+  clint->load(CLINT_MTIME_BASE, sizeof(mtime), (uint8_t*)&mtime);
+  for (size_t i = 0; i < procs.size(); i++) {
+    uint64_t mtimecmp;
+    clint->load(CLINT_MTIMECMP_BASE + i * sizeof(mtimecmp), sizeof(mtimecmp),
+                (uint8_t*)&mtimecmp);
+    if (mtimecmp > mtime)
+      wait = std::min(wait, mtimecmp - mtime);
+  }
+  // Also covers a compare register parked at -1 to turn the timer off.
+  if (wait >= UINT64_MAX / INSNS_PER_RTC_TICK - clint_ticks)
+    return;
+
+  clint_event = events.schedule((clint_ticks + wait) * INSNS_PER_RTC_TICK, [this] {
+    sync_clint();
+    schedule_clint();
+  });
+}
+
+void sim_t::print_quantum_stats()
+{
+  uint64_t steps = 0;
+  for (auto& q : quantum_stats.sizes)
+    steps += q.first * q.second;
+
+  fprintf(stderr, "quantum: %" PRIu64 " rounds, %" PRIu64 " steps per hart, "
+          "grown %" PRIu64 " times, shrunk %" PRIu64 " times\n",
+          quantum_stats.rounds, steps, quantum_stats.grown, quantum_stats.shrunk);
+  for (auto& q : quantum_stats.sizes)
+    fprintf(stderr, "quantum: %8zu steps %10" PRIu64 " rounds\n", q.first, q.second);
+  fprintf(stderr, "quantum: all harts idle in wfi, skipped %" PRIu64 " ticks in %" PRIu64 " jumps\n",
+          quantum_stats.idle_ticks, quantum_stats.idle_jumps);
+}
+
+static bool triggers_armed(state_t* state)
+{
+  for (unsigned i = 0; i < state->num_triggers; i++)
+    if (state->mcontrol[i].execute || state->mcontrol[i].load || state->mcontrol[i].store)
+      return true;
+  return false;
+}
+
+#ifdef RISCV_ENABLE_COMMITLOG
+// Run op and log it the way processor_t::step prints it: only if it
+// retired, and with the privilege it ran at.
+static reg_t run_logged(commit_log_t* log, processor_t* p, block_op_t* op, reg_t pc)
+{
+  state_t* state = p->get_state();
+  reg_t prv = state->prv;
+  reg_t npc = op->fetch.func(p, op->fetch.insn, pc);
+  if (npc == PC_SERIALIZE_BEFORE || npc == PC_ILLEGAL_INSN)
+    return npc;
+
+  insn_t insn = op->fetch.insn;
+  uint64_t mask = (insn.length() == 8 ? uint64_t(0) : (uint64_t(1) << (insn.length() * 8))) - 1;
+  commit_log_record_t r;
+  r.pc = pc;
+  r.insn = insn.bits() & mask;
+  r.wdata = state->log_reg_write.data.v[0];
+  r.mem_addr = commit_log_mem.addr;
+  r.mem_data = commit_log_mem.data;
+  r.prv = prv;
+  r.reg = state->log_reg_write.addr;
+  r.mem_size = commit_log_mem.size;
+  r.mem_store = commit_log_mem.store;
+  r.reserved = 0;
+  log->push(r);
+
+  state->log_reg_write.addr = 0;
+  commit_log_mem.size = 0;
+  return npc;
+}
+#endif
+
+// Same contract as processor_t::step, but dispatches a whole cached basic
+// block at a time.  Anything that needs to look at every instruction falls
+// back to the processor's own loop.
+void sim_t::step_blocks(size_t i, size_t n)
+{
+  processor_t* p = procs[i];
+  block_cache_t* bc = block_caches[i].get();
+  state_t* state = p->get_state();
+
+#ifdef RISCV_ENABLE_COMMITLOG
+  // The text log is printed by processor_t::step; the binary one is
+  // written here, one op at a time.
+  bool logging = commit_log != NULL;
+  bool slow = !logging || histogram_enabled;
+#else
+  const bool logging = false;
+  bool slow = histogram_enabled;
+#endif
+  sync_mip(i);
+  if (slow || p->slow_path() || p->halt_request || state->dcsr.halt ||
+      triggers_armed(state)) {
+    // The per-instruction loop may run debug code that rewrites memory.
+    bc->flush();
+    in_wfi[i] = false;
+    p->step(n);
+    return;
+  }
+
+  if (in_wfi[i]) {
+    if (!wakes_from_wfi(p))
+      return;
+    in_wfi[i] = false;
+  }
+
+  while (n > 0) {
+    size_t instret = 0;
+    reg_t pc = state->pc;
+
+    try
+    {
+      sync_mip(i);
+      p->take_pending_interrupt();
+
+      block_t* b = NULL;
+      while (instret < n) {
+        size_t len, k = 0;
+        reg_t npc = pc;
+        const aot_block_desc_t* a = aot && !logging ? aot->lookup(p, pc) : NULL;
+
+        if (a && a->length <= n - instret) {
+          // Statically translated block; it reports how far it got.
+          aot_frame_t f = {pc, 0};
+          try {
+            npc = a->func(p, &f);
+          } catch (trap_t&) {
+            pc = f.pc;
+            instret += f.n;
+            throw;
+          }
+          b = NULL;
+          len = a->length;
+          k = f.n;
+          pc = f.pc;
+          instret += k;
+        } else {
+          b = b ? bc->next(b, pc, state->prv) : bc->lookup(pc, state->prv);
+          if (unlikely(b->syncs_instret)) {
+            // b starts with a counter read served without serializing.
+            state->minstret += instret;
+            n -= instret;
+            instret = 0;
+          }
+          len = std::min(b->length, n - instret);
+
+          bc->enter(b);
+          if (b->native && len == b->length && !logging) {
+            k = bc->jit->run(b, &npc);
+            instret += k;
+            if (k > 0)
+              pc = b->ops[k - 1].next;
+            bc->jit->rethrow_trap();
+          } else {
+            try {
+              for (; k < len; k++) {
+                block_op_t* op = &b->ops[k];
+                if (op->fused && k + 1 < len && !logging) {
+                  // Unless it stopped after the first op, a fused pair
+                  // retires both, and the second one decides what follows.
+                  npc = op->fused(p, op, pc);
+                  if (npc != op->next) {
+                    pc = op->next;
+                    op++;
+                    k++;
+                  }
+#ifdef RISCV_ENABLE_COMMITLOG
+                } else if (logging) {
+                  npc = run_logged(commit_log.get(), p, op, pc);
+#endif
+                } else {
+                  npc = op->fetch.func(p, op->fetch.insn, pc);
+                }
+                if (unlikely(npc != op->next))
+                  break;
+                pc = npc;
+              }
+            } catch (trap_t&) {
+              // The ops before the one that trapped have retired.
+              instret += k;
+              throw;
+            }
+            instret += k;
+          }
+        }
+
+        if (k < len) {
+          if (unlikely(invalid_pc(npc))) {
+            switch (npc) {
+              case PC_SERIALIZE_BEFORE: state->serialized = true; state->pc = pc; break;
+              case PC_SERIALIZE_AFTER: {
+                n = ++instret;
+                pc = state->pc;
+                // wfi is a serializing nop to the handlers; stall here
+                // instead, until something can wake the hart.
+                insn_bits_t bits = b ? b->ops[k].fetch.insn.bits() : a->bits[k];
+                if (bits == MATCH_WFI) {
+                  sync_mip(i);
+                  in_wfi[i] = !wakes_from_wfi(p);
+                }
+                break;
+              }
+              case PC_ILLEGAL_INSN: {
+                // Returned by a handler instead of throwing; see decode.h.
+                trap_illegal_instruction t(0);
+                p->take_trap(t, pc);
+                n = instret;
+                break;
+              }
+              default: abort();
+            }
+            if (npc == PC_SERIALIZE_AFTER &&
+                (!b || block_cache_t::flushes_blocks(b->ops[k].fetch.insn.bits())))
+              bc->flush();
+            break;
+          }
+          // A branch left the block, or went the other way from the
+          // direction a superblock expected.
+          pc = npc;
+          instret++;
+          k++;
+        }
+
+        if (b && k == b->length) {
+          if (unlikely(block_cache_t::flushes_blocks(b->ops[k - 1].fetch.insn.bits())))
+            bc->flush();
+          bc->profile(b, pc);
+        } else if (!b && k == len && a->flushes) {
+          bc->flush();
+        }
+        state->pc = pc;
+      }
+    }
+    catch(trap_t& t)
+    {
+      p->take_trap(t, pc);
+      n = instret;
+    }
+
+    state->minstret += instret;
+    n -= instret;
+  }
+}
+
+void sim_t::set_block_mode(bool value)
+{
+  block_mode = value;
+}
+
+void sim_t::set_jit(bool value)
+{
+  for (auto& bc : block_caches)
+    bc->set_jit(value);
+}
+
+void sim_t::set_commit_log(const char* path)
+{
+#ifdef RISCV_ENABLE_COMMITLOG
+  commit_log.reset(new commit_log_t(path));
+#else
+  fprintf(stderr, "Commit logging support has not been properly enabled;\n");
+  fprintf(stderr, "please re-build the riscv-isa-run project using \"configure --enable-commitlog\".\n");
+  abort();
+#endif
+}
+
+void sim_t::set_hart_threads(size_t threads, size_t quantum)
+{
+  threads = std::min(threads, procs.size());
+  if (quantum == 0)
+    quantum = INTERLEAVE;
+  // Whole timer ticks, so the quanta add up to the time the serial loop
+  // would have counted.
+  hart_quantum = std::max(quantum / INSNS_PER_RTC_TICK, size_t(1)) * INSNS_PER_RTC_TICK;
+
+  hart_pool.reset();
+  if (threads <= 1)
+    return;
+
+  hart_pool.reset(new hart_pool_t(threads, [this, threads](size_t group) {
+    for (size_t i = group; i < procs.size(); i += threads) {
+      if (block_mode) {
+        step_blocks(i, hart_steps);
+      } else {
+        sync_mip(i);
+        procs[i]->step(hart_steps);
+      }
+    }
+  }));
+}
+
+void sim_t::set_quantum_stats(bool value)
+{
+  quantum_stats_enabled = value;
+}
+
 void sim_t::set_debug(bool value)
 {
   debug = value;
@@ -143,10 +638,21 @@ void sim_t::set_procs_debug(bool value)
     procs[i]->set_debug(value);
 }
 
+static bool in_clint(reg_t addr)
+{
+  return addr >= CLINT_BASE && addr - CLINT_BASE < CLINT_SIZE;
+}
+
 bool sim_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
 {
   if (addr + len < addr)
     return false;
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (hart_pool)
+    lock.lock();
+  round_mmio++;
+  if (in_clint(addr))
+    sync_clint();
   return bus.load(addr, len, bytes);
 }
 
@@ -154,90 +660,32 @@ bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
 {
   if (addr + len < addr)
     return false;
-  return bus.store(addr, len, bytes);
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (hart_pool)
+    lock.lock();
+  round_mmio++;
+  if (!in_clint(addr))
+    return bus.store(addr, len, bytes);
+
+  // mtime or an mtimecmp may have moved: recompute the timer interrupts
+  // and when the next one is due.
+  sync_clint();
+  bool ok = bus.store(addr, len, bytes);
+  clint->increment(0);
+  schedule_clint();
+  return ok;
 }
 
-static std::string dts_compile(const std::string& dts)
+static std::string hex(reg_t x)
 {
-  // Convert the DTS to DTB
-  int dts_pipe[2];
-  pid_t dts_pid;
-
-  if (pipe(dts_pipe) != 0 || (dts_pid = fork()) < 0) {
-    std::cerr << "Failed to fork dts child: " << strerror(errno) << std::endl;
-    exit(1);
-  }
-
-  // Child process to output dts
-  if (dts_pid == 0) {
-    close(dts_pipe[0]);
-    int step, len = dts.length();
-    const char *buf = dts.c_str();
-    for (int done = 0; done < len; done += step) {
-      step = write(dts_pipe[1], buf+done, len-done);
-      if (step == -1) {
-        std::cerr << "Failed to write dts: " << strerror(errno) << std::endl;
-        exit(1);
-      }
-    }
-    close(dts_pipe[1]);
-    exit(0);
-  }
-
-  pid_t dtb_pid;
-  int dtb_pipe[2];
-  if (pipe(dtb_pipe) != 0 || (dtb_pid = fork()) < 0) {
-    std::cerr << "Failed to fork dtb child: " << strerror(errno) << std::endl;
-    exit(1);
-  }
-
-  // Child process to output dtb
-  if (dtb_pid == 0) {
-    dup2(dts_pipe[0], 0);
-    dup2(dtb_pipe[1], 1);
-    close(dts_pipe[0]);
-    close(dts_pipe[1]);
-    close(dtb_pipe[0]);
-    close(dtb_pipe[1]);
-    execl(DTC, DTC, "-O", "dtb", 0);
-    std::cerr << "Failed to run " DTC ": " << strerror(errno) << std::endl;
-    exit(1);
-  }
-
-  close(dts_pipe[1]);
-  close(dts_pipe[0]);
-  close(dtb_pipe[1]);
-
-  // Read-out dtb
-  std::stringstream dtb;
-
-  int got;
-  char buf[4096];
-  while ((got = read(dtb_pipe[0], buf, sizeof(buf))) > 0) {
-    dtb.write(buf, got);
-  }
-  if (got == -1) {
-    std::cerr << "Failed to read dtb: " << strerror(errno) << std::endl;
-    exit(1);
-  }
-  close(dtb_pipe[0]);
-
-  // Reap children
-  int status;
-  waitpid(dts_pid, &status, 0);
-  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-    std::cerr << "Child dts process failed" << std::endl;
-    exit(1);
-  }
-  waitpid(dtb_pid, &status, 0);
-  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-    std::cerr << "Child dtb process failed" << std::endl;
-    exit(1);
-  }
-
-  return dtb.str();
+  char buf[20];
+  snprintf(buf, sizeof(buf), "%" PRIx64, uint64_t(x));
+  return buf;
 }
 
+static uint32_t hi(reg_t x) { return x >> 32; }
+static uint32_t lo(reg_t x) { return uint32_t(x); }
+
 void sim_t::make_dtb()
 {
   const int reset_vec_size = 8;
@@ -258,68 +706,57 @@ void sim_t::make_dtb()
 
   std::vector<char> rom((char*)reset_vec, (char*)reset_vec + sizeof(reset_vec));
 
-  std::stringstream s;
-  s << std::dec <<
-         "/dts-v1/;\n"
-         "\n"
-         "/ {\n"
-         "  #address-cells = <2>;\n"
-         "  #size-cells = <2>;\n"
-         "  compatible = \"ucbbar,spike-bare-dev\";\n"
-         "  model = \"ucbbar,spike-bare\";\n"
-         "  cpus {\n"
-         "    #address-cells = <1>;\n"
-         "    #size-cells = <0>;\n"
-         "    timebase-frequency = <" << (CPU_HZ/INSNS_PER_RTC_TICK) << ">;\n";
+  fdt_node_t root("");
+  root.add_cells("#address-cells", {2});
+  root.add_cells("#size-cells", {2});
+  root.add_strings("compatible", {"ucbbar,spike-bare-dev"});
+  root.add_strings("model", {"ucbbar,spike-bare"});
+
+  fdt_node_t* cpus = root.add_node("cpus");
+  cpus->add_cells("#address-cells", {1});
+  cpus->add_cells("#size-cells", {0});
+  cpus->add_cells("timebase-frequency", {CPU_HZ / INSNS_PER_RTC_TICK});
   for (size_t i = 0; i < procs.size(); i++) {
-    s << "    CPU" << i << ": cpu@" << i << " {\n"
-         "      device_type = \"cpu\";\n"
-         "      reg = <" << i << ">;\n"
-         "      status = \"okay\";\n"
-         "      compatible = \"riscv\";\n"
-         "      riscv,isa = \"" << procs[i]->get_isa_string() << "\";\n"
-         "      mmu-type = \"riscv," << (procs[i]->get_max_xlen() <= 32 ? "sv32" : "sv48") << "\";\n"
-         "      clock-frequency = <" << CPU_HZ << ">;\n"
-         "      CPU" << i << "_intc: interrupt-controller {\n"
-         "        #interrupt-cells = <1>;\n"
-         "        interrupt-controller;\n"
-         "        compatible = \"riscv,cpu-intc\";\n"
-         "      };\n"
-         "    };\n";
+    std::string cpu_label = "CPU" + std::to_string(i);
+    fdt_node_t* cpu = cpus->add_node("cpu@" + std::to_string(i), cpu_label);
+    cpu->add_strings("device_type", {"cpu"});
+    cpu->add_cells("reg", {uint32_t(i)});
+    cpu->add_strings("status", {"okay"});
+    cpu->add_strings("compatible", {"riscv"});
+    cpu->add_strings("riscv,isa", {procs[i]->get_isa_string()});
+    cpu->add_strings("mmu-type", {procs[i]->get_max_xlen() <= 32 ? "riscv,sv32" : "riscv,sv48"});
+    cpu->add_cells("clock-frequency", {CPU_HZ});
+    fdt_node_t* intc = cpu->add_node("interrupt-controller", cpu_label + "_intc");
+    intc->add_cells("#interrupt-cells", {1});
+    intc->add_empty("interrupt-controller");
+    intc->add_strings("compatible", {"riscv,cpu-intc"});
   }
-  s <<   "  };\n";
+
   for (auto& m : mems) {
-    s << std::hex <<
-         "  memory@" << m.first << " {\n"
-         "    device_type = \"memory\";\n"
-         "    reg = <0x" << (m.first >> 32) << " 0x" << (m.first & (uint32_t)-1) <<
-                   " 0x" << (m.second->size() >> 32) << " 0x" << (m.second->size() & (uint32_t)-1) << ">;\n"
-         "  };\n";
+    fdt_node_t* mem = root.add_node("memory@" + hex(m.first));
+    mem->add_strings("device_type", {"memory"});
+    mem->add_cells("reg", {hi(m.first), lo(m.first), hi(m.second->size()), lo(m.second->size())});
   }
-  s <<   "  soc {\n"
-         "    #address-cells = <2>;\n"
-         "    #size-cells = <2>;\n"
-         "    compatible = \"ucbbar,spike-bare-soc\", \"simple-bus\";\n"
-         "    ranges;\n"
-         "    clint@" << CLINT_BASE << " {\n"
-         "      compatible = \"riscv,clint0\";\n"
-         "      interrupts-extended = <" << std::dec;
-  for (size_t i = 0; i < procs.size(); i++)
-    s << "&CPU" << i << "_intc 3 &CPU" << i << "_intc 7 ";
-  reg_t clintbs = CLINT_BASE;
-  reg_t clintsz = CLINT_SIZE;
-  s << std::hex << ">;\n"
-         "      reg = <0x" << (clintbs >> 32) << " 0x" << (clintbs & (uint32_t)-1) <<
-                     " 0x" << (clintsz >> 32) << " 0x" << (clintsz & (uint32_t)-1) << ">;\n"
-         "    };\n"
-         "  };\n"
-         "  htif {\n"
-         "    compatible = \"ucb,htif0\";\n"
-         "  };\n"
-         "};\n";
-
-  dts = s.str();
-  std::string dtb = dts_compile(dts);
+
+  fdt_node_t* soc = root.add_node("soc");
+  soc->add_cells("#address-cells", {2});
+  soc->add_cells("#size-cells", {2});
+  soc->add_strings("compatible", {"ucbbar,spike-bare-soc", "simple-bus"});
+  soc->add_empty("ranges");
+  fdt_node_t* clint_node = soc->add_node("clint@" + hex(CLINT_BASE));
+  clint_node->add_strings("compatible", {"riscv,clint0"});
+  std::vector<fdt_cell_t> irqs;
+  for (size_t i = 0; i < procs.size(); i++) {
+    std::string intc = "CPU" + std::to_string(i) + "_intc";
+    irqs.insert(irqs.end(), {intc, 3, intc, 7});
+  }
+  clint_node->add_cells("interrupts-extended", irqs);
+  clint_node->add_cells("reg", {hi(CLINT_BASE), lo(CLINT_BASE), hi(CLINT_SIZE), lo(CLINT_SIZE)});
+
+  root.add_node("htif")->add_strings("compatible", {"ucb,htif0"});
+
+  dts = root.dts();
+  std::string dtb = root.dtb();
 
   rom.insert(rom.end(), dtb.begin(), dtb.end());
   const int align = 0x1000;
@@ -330,10 +767,20 @@ void sim_t::make_dtb()
 }
 
 char* sim_t::addr_to_mem(reg_t addr) {
+  size_t offset;
+  if (mem_t* mem = find_mem(addr, &offset))
+    return mem->contents() + offset;
+  return NULL;
+}
+
+mem_t* sim_t::find_mem(reg_t addr, size_t* offset)
+{
   auto desc = bus.find_device(addr);
   if (auto mem = dynamic_cast<mem_t*>(desc.second))
-    if (addr - desc.first < mem->size())
-      return mem->contents() + (addr - desc.first);
+    if (addr - desc.first < mem->size()) {
+      *offset = addr - desc.first;
+      return mem;
+    }
   return NULL;
 }
 
@@ -342,6 +789,8 @@ char* sim_t::addr_to_mem(reg_t addr) {
 void sim_t::reset()
 {
   make_dtb();
+  if (!snapshot_load_path.empty())
+    load_snapshot(snapshot_load_path.c_str());
 }
 
 void sim_t::idle()
@@ -349,19 +798,98 @@ void sim_t::idle()
   target.switch_to();
 }
 
+// fesvr's accesses come in aligned chunks of up to chunk_max_size() bytes.
+// The parts in memory are copied a page at a time; anything else, which
+// devices see, goes through the debug MMU a word at a time as before.
+// Returns how many bytes at taddr are memory, up to the page's end.
+size_t sim_t::chunk_piece(addr_t taddr, size_t len, char** host)
+{
+  size_t offset;
+  mem_t* mem = find_mem(taddr, &offset);
+  *host = mem ? mem->contents() + offset : NULL;
+  if (!mem)
+    return 0;
+  size_t page = HTIF_PAGE - taddr % HTIF_PAGE;
+  return std::min(std::min(len, page), mem->size() - offset);
+}
+
 void sim_t::read_chunk(addr_t taddr, size_t len, void* dst)
 {
-  assert(len == 8);
-  auto data = debug_mmu->load_uint64(taddr);
-  memcpy(dst, &data, sizeof data);
+  char* to = (char*)dst;
+  while (len) {
+    char* host;
+    size_t n = chunk_piece(taddr, len, &host);
+    if (n) {
+      memcpy(to, host, n);
+    } else {
+      n = sizeof(uint64_t);
+      auto data = debug_mmu->load_uint64(taddr);
+      memcpy(to, &data, n);
+    }
+    taddr += n;
+    to += n;
+    len -= n;
+  }
 }
 
 void sim_t::write_chunk(addr_t taddr, size_t len, const void* src)
 {
-  assert(len == 8);
-  uint64_t data;
-  memcpy(&data, src, sizeof data);
-  debug_mmu->store_uint64(taddr, data);
+  if (!checkpoints.empty()) {
+    const char* from = (const char*)src;
+    host_writes.push_back(host_write_t{host_steps, taddr, std::vector<char>(from, from + len)});
+  }
+  write_target(taddr, len, src);
+}
+
+// Pages that already hold what is written are left alone: loading a mapped
+// program writes what is there already (see program_map.cc), and leaving
+// it keeps the page shared.
+void sim_t::write_target(addr_t taddr, size_t len, const void* src)
+{
+  const char* from = (const char*)src;
+  while (len) {
+    char* host;
+    size_t n = chunk_piece(taddr, len, &host);
+    if (n) {
+      if (memcmp(host, from, n) != 0) {
+        memcpy(host, from, n);
+        write_code_lines(taddr, n);
+        round_htif++;
+      }
+    } else {
+      n = sizeof(uint64_t);
+      uint64_t data;
+      memcpy(&data, from, n);
+      debug_mmu->store_uint64(taddr, data);
+      round_htif++;
+    }
+    taddr += n;
+    from += n;
+    len -= n;
+  }
+}
+
+void sim_t::clear_chunk(addr_t taddr, size_t len)
+{
+  static const char zeros[HTIF_PAGE] = {};
+  while (len) {
+    char* host;
+    size_t n = chunk_piece(taddr, len, &host);
+    if (!n)
+      n = sizeof(uint64_t);
+    write_chunk(taddr, n, zeros);
+    taddr += n;
+    len -= n;
+  }
+}
+
+// Like a hart's store (see code_line_store), a host write into cached code
+// makes the block caches start again.
+void sim_t::write_code_lines(addr_t taddr, size_t len)
+{
+  const reg_t line = reg_t(1) << CODE_LINE_SHIFT;
+  for (reg_t a = taddr & -line; a < taddr + len; a += line)
+    code_line_store(a);
 }
 
 void sim_t::proc_reset(unsigned id)
@@ -0,0 +1,273 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_SIM_H
+#define _RISCV_SIM_H
+
+#include "processor.h"
+#include "devices.h"
+#include "debug_module.h"
+#include "event_queue.h"
+#include <fesvr/htif.h>
+#include <fesvr/context.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+// clint.cc's register map.  The CLINT's time and compare registers are
+// read and written through its MMIO interface.
+#define CLINT_MSIP_BASE 0
+#define CLINT_MTIMECMP_BASE 0x4000
+#define CLINT_MTIME_BASE 0xbff8
+
+// Everything about the machine but its memory and boot ROM: what snapshots
+// and checkpoints save (see snapshot.cc).
+struct machine_state_t
+{
+  uint64_t time;                  // simulated time, in steps
+  size_t quantum;
+  size_t preferred_quantum;
+  size_t round_mmio;              // what the current round has seen so far
+  size_t round_htif;
+  // Each hart's state_t as raw bytes, sizeof(state_t) apiece: a
+  // std::vector<state_t> would not keep the register file's alignment
+  // before C++17.
+  std::vector<char> harts;
+  std::vector<uint8_t> in_wfi;
+  uint64_t mtime;
+  std::vector<uint64_t> mtimecmp;
+  std::vector<uint32_t> msip;
+};
+
+// A machine state kept in memory for reverse execution (see checkpoint.cc).
+struct checkpoint_t
+{
+  uint64_t steps;           // sim_t::executed_steps when it was taken
+  machine_state_t machine;
+  // Pages (dirty_pages_t ids) written since the checkpoint before, as they
+  // were at this one; the oldest checkpoint has every page not all zero.
+  std::unordered_map<uint64_t, std::vector<char>> pages;
+};
+
+// Something the host wrote into the target while it had its turn, kept so
+// running again from a checkpoint can write it again (see checkpoint.cc).
+struct host_write_t
+{
+  uint64_t steps;           // sim_t::executed_steps at the host's turn
+  uint64_t addr;
+  std::vector<char> bytes;
+};
+
+class mmu_t;
+class remote_bitbang_t;
+class block_cache_t;
+class aot_table_t;
+class commit_log_t;
+class hart_pool_t;
+class dirty_pages_t;
+
+// this class encapsulates the processors and memory in a RISC-V machine.
+class sim_t : public htif_t
+{
+public:
+  sim_t(const char* isa, size_t _nprocs,  bool halted, reg_t start_pc,
+        std::vector<std::pair<reg_t, mem_t*>> mems,
+        const std::vector<std::string>& args, const std::vector<int> hartids,
+        unsigned progsize, unsigned max_bus_master_bits, bool require_authentication);
+  ~sim_t();
+
+  // run the simulation to completion
+  int run();
+  void set_debug(bool value);
+  void set_log(bool value);
+  void set_histogram(bool value);
+  void set_procs_debug(bool value);
+  void set_block_mode(bool value); // on by default
+  // Translate hot blocks to host code, if possible; off by default.
+  void set_jit(bool value);
+  // Write a binary commit log (commit_log.h) to path instead of printing
+  // one; needs a build configured with --enable-commitlog.
+  void set_commit_log(const char* path);
+  // Run the harts on up to threads host threads, each for quantum
+  // instructions (0 for the default) at a time between barriers; threads
+  // <= 1 runs them all on the simulator thread, as before.
+  void set_hart_threads(size_t threads, size_t quantum = 0);
+  // Save the whole machine to path at the first round boundary at or after
+  // simulated time at (in steps; see event_queue.h), then carry on.
+  void set_snapshot_save(const char* path, uint64_t at);
+  // After the program is loaded, replace the machine with a saved one.
+  void set_snapshot_load(const char* path);
+  // Keep a checkpoint every interval steps, up to keep of them, for the
+  // interactive reverse-execution commands; 0 turns them off.  The harts
+  // stay on one thread while they are on.
+  void set_checkpoints(uint64_t interval, size_t keep);
+  // Print how the quantum adapted (see adapt_quantum) when done.
+  void set_quantum_stats(bool value);
+  void set_remote_bitbang(remote_bitbang_t* remote_bitbang) {
+    this->remote_bitbang = remote_bitbang;
+  }
+  const char* get_dts() { if (dts.empty()) reset(); return dts.c_str(); }
+  processor_t* get_core(size_t i) { return procs.at(i); }
+  // For devices to schedule wakeups in simulated time.
+  event_queue_t& get_events() { return events; }
+  unsigned nprocs() const { return procs.size(); }
+
+  // Callback for processors to let the simulation know they were reset.
+  void proc_reset(unsigned id);
+
+private:
+  std::vector<std::pair<reg_t, mem_t*>> mems;
+  mmu_t* debug_mmu;  // debug port into main memory
+  std::vector<processor_t*> procs;
+  std::vector<std::unique_ptr<block_cache_t>> block_caches;
+  // Hart i ran wfi with nothing to wake it, and runs no further until an
+  // enabled interrupt is pending.  Bytes, not bits: the hart pool writes
+  // them from several threads.
+  std::vector<uint8_t> in_wfi;
+  reg_t start_pc;
+  std::string dts;
+  std::unique_ptr<rom_device_t> boot_rom;
+  std::unique_ptr<clint_t> clint;
+  bus_t bus;
+
+  processor_t* get_core(const std::string& i);
+  void step(size_t n); // step through simulation
+  void step_blocks(size_t i, size_t n); // run hart i through the block cache
+  void step_parallel(size_t n); // run every hart n steps on the hart pool
+  bool can_step_parallel();
+  void adapt_quantum(); // size the next round's quantum
+  void fast_forward_idle(); // skip time no hart can use
+  size_t steps_to_next_event(); // whole ticks, at least one
+  void sync_clint(); // bring the CLINT's mtime up to now
+  void schedule_clint(); // wake up when its next mtimecmp is due
+  void sync_mip(size_t i); // give hart i the CLINT's interrupts
+  void check_snapshot(); // save one if it is time (see set_snapshot_save)
+  void save_snapshot(const char* path);
+  void load_snapshot(const char* path);
+  // Only at round boundaries, when no hart is running.
+  void save_machine_state(machine_state_t* s);
+  void restore_machine_state(const machine_state_t& s);
+  void check_checkpoint(); // take one if it is time (see set_checkpoints)
+  void restore_checkpoint(size_t i);
+  bool reverse_to(uint64_t steps);
+  bool reverse_until(const std::function<bool()>& cond);
+  void host_turn(); // let the host run, or replay what it did
+  void print_quantum_stats();
+  static const size_t INTERLEAVE = 5000; // default quantum
+  static const size_t MIN_INTERLEAVE = 500;
+  static const size_t MAX_INTERLEAVE = 200000;
+  static const size_t INSNS_PER_RTC_TICK = 100; // 10 MHz clock for 1 BIPS core
+  static const size_t CPU_HZ = 1000000000; // 1GHz CPU
+  size_t quantum; // steps each hart runs this round
+  size_t preferred_quantum; // what adapt_quantum() wants, events aside
+  size_t current_step;
+  size_t current_proc;
+  size_t round_mmio; // device accesses this round
+  size_t round_htif; // host writes into target memory this round
+  struct quantum_stats_t {
+    uint64_t rounds;
+    uint64_t grown;
+    uint64_t shrunk;
+    uint64_t idle_jumps; // times fast_forward_idle() moved mtime
+    uint64_t idle_ticks; // and by how much in all
+    std::map<size_t, uint64_t> sizes; // rounds run at each quantum
+  } quantum_stats;
+  bool quantum_stats_enabled;
+  event_queue_t events;
+  uint64_t clint_ticks; // ticks the CLINT has been given so far
+  event_id_t clint_event;
+  std::string snapshot_save_path; // empty once saved
+  uint64_t snapshot_save_at;
+  std::string snapshot_load_path;
+  uint64_t executed_steps; // by step(), since the simulation began
+  uint64_t checkpoint_interval;
+  size_t checkpoint_keep;
+  std::deque<checkpoint_t> checkpoints; // oldest first
+  std::unique_ptr<dirty_pages_t> dirty_pages; // from the first checkpoint
+  std::deque<host_write_t> host_writes; // since the oldest checkpoint
+  uint64_t host_steps; // executed_steps at the host's last real turn
+  bool debug;
+  bool log;
+  bool histogram_enabled; // provide a histogram of PCs
+  bool block_mode; // dispatch whole basic blocks instead of single insns
+  aot_table_t* aot; // blocks translated ahead of time, if any were linked in
+  std::unique_ptr<commit_log_t> commit_log;
+  std::unique_ptr<hart_pool_t> hart_pool;
+  size_t hart_quantum; // steps each pool thread runs between barriers
+  size_t hart_steps; // steps each hart runs in the current quantum
+  std::mutex mmio_lock; // devices are not thread-safe; taken with a pool
+  remote_bitbang_t* remote_bitbang;
+
+  // memory-mapped I/O routines
+  char* addr_to_mem(reg_t addr);
+  mem_t* find_mem(reg_t addr, size_t* offset);
+  bool mmio_load(reg_t addr, size_t len, uint8_t* bytes);
+  bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes);
+  void make_dtb();
+
+  // presents a prompt for introspection into the simulation
+  void interactive();
+
+  // functions that help implement interactive()
+  void interactive_help(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_quit(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_run(const std::string& cmd, const std::vector<std::string>& args, bool noisy);
+  void interactive_run_noisy(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_run_silent(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_reg(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_freg(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_fregs(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_fregd(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_pc(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_mem(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_str(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_until(const std::string& cmd, const std::vector<std::string>& args, bool noisy);
+  void interactive_until_silent(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_until_noisy(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_rstep(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_rcont(const std::string& cmd, const std::vector<std::string>& args);
+  bool can_reverse();
+  reg_t get_reg(const std::vector<std::string>& args);
+  freg_t get_freg(const std::vector<std::string>& args);
+  reg_t get_mem(const std::vector<std::string>& args);
+  reg_t get_pc(const std::vector<std::string>& args);
+
+  friend class processor_t;
+  friend class mmu_t;
+  friend class debug_module_t;
+
+  // htif
+  friend void sim_thread_main(void*);
+  void main();
+
+  context_t* host;
+  context_t target;
+  std::vector<std::string> htif_args;
+  void reset();
+  void idle();
+  void load_program();
+  void map_program(); // see program_map.cc
+  void read_chunk(addr_t taddr, size_t len, void* dst);
+  void write_chunk(addr_t taddr, size_t len, const void* src);
+  void write_target(addr_t taddr, size_t len, const void* src);
+  void clear_chunk(addr_t taddr, size_t len);
+  size_t chunk_piece(addr_t taddr, size_t len, char** host);
+  void write_code_lines(addr_t taddr, size_t len);
+  static const size_t HTIF_PAGE = 4096;
+  size_t chunk_align() { return 8; }
+  size_t chunk_max_size() { return 1 << 20; }
+
+public:
+  // Initialize this after procs, because in debug_module_t::reset() we
+  // enumerate processors, which segfaults if procs hasn't been initialized
+  // yet.
+  debug_module_t debug_module;
+};
+
+extern volatile bool ctrlc_pressed;
+
+#endif
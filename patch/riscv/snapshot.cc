@@ -0,0 +1,291 @@
+// See LICENSE for license details.
+
+// Whole-machine snapshots.  A snapshot holds each hart's state_t as raw
+// bytes, the way state_t::reset() treats it, so it only loads into the
+// simulator build and configuration that wrote it; the header checks what
+// it can.  Memory goes a page at a time, leaving out pages that are all
+// zero.  The CLINT and boot ROM are saved through their MMIO interfaces.
+//
+// What is not saved: the debug module, which must be idle, and the host
+// side of HTIF.  Take snapshots while no HTIF request is outstanding;
+// tohost and fromhost themselves are in target memory and are saved.
+
+#include "sim.h"
+#include "mmu.h"
+#include "block_cache.h"
+#include "remote_bitbang.h"
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_MAGIC "LISCSNAP"
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_PAGE 4096
+#define SNAPSHOT_END uint64_t(-1)  // follows a region's last saved page
+
+struct snapshot_header_t
+{
+  char magic[8];            // SNAPSHOT_MAGIC
+  uint32_t version;         // SNAPSHOT_VERSION
+  uint32_t state_size;      // sizeof(state_t)
+  uint32_t nprocs;
+  uint32_t nmems;
+  uint64_t time;            // simulated time, in steps
+};
+
+// A snapshot file that gives up on the simulation if anything goes wrong.
+class snapshot_file_t
+{
+public:
+  snapshot_file_t(const char* path, const char* mode) : path(path)
+  {
+    f = fopen(path, mode);
+    if (!f) {
+      perror(path);
+      exit(1);
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+  }
+
+  ~snapshot_file_t()
+  {
+    if (fclose(f) != 0)
+      fail("write failed");
+  }
+
+  void write(const void* p, size_t n)
+  {
+    if (fwrite(p, 1, n, f) != n)
+      fail("write failed");
+  }
+
+  void read(void* p, size_t n)
+  {
+    if (fread(p, 1, n, f) != n)
+      fail("truncated");
+  }
+
+  template<class T> void put(const T& x) { write(&x, sizeof(x)); }
+  template<class T> T get() { T x; read(&x, sizeof(x)); return x; }
+
+  void put_string(const std::string& s)
+  {
+    put<uint32_t>(s.size());
+    write(s.data(), s.size());
+  }
+
+  std::string get_string()
+  {
+    std::string s(get<uint32_t>(), '\0');
+    read(&s[0], s.size());
+    return s;
+  }
+
+  void fail(const char* why)
+  {
+    fprintf(stderr, "snapshot %s: %s\n", path, why);
+    exit(1);
+  }
+
+private:
+  const char* path;
+  FILE* f;
+};
+
+static const char zero_page[SNAPSHOT_PAGE] = {};
+
+void sim_t::set_snapshot_save(const char* path, uint64_t at)
+{
+  snapshot_save_path = path;
+  snapshot_save_at = at;
+}
+
+void sim_t::set_snapshot_load(const char* path)
+{
+  snapshot_load_path = path;
+}
+
+// Called at round boundaries, when no hart is running.
+void sim_t::check_snapshot()
+{
+  if (snapshot_save_path.empty() || events.now() < snapshot_save_at)
+    return;
+  save_snapshot(snapshot_save_path.c_str());
+  snapshot_save_path.clear();
+}
+
+void sim_t::save_machine_state(machine_state_t* s)
+{
+  s->time = events.now();
+  s->quantum = quantum;
+  s->preferred_quantum = preferred_quantum;
+  s->round_mmio = round_mmio;
+  s->round_htif = round_htif;
+  s->harts.resize(procs.size() * sizeof(state_t));
+  sync_clint();
+  for (size_t i = 0; i < procs.size(); i++) {
+    sync_mip(i);
+    memcpy(&s->harts[i * sizeof(state_t)], procs[i]->get_state(), sizeof(state_t));
+  }
+  s->in_wfi = in_wfi;
+
+  clint->load(CLINT_MTIME_BASE, sizeof(s->mtime), (uint8_t*)&s->mtime);
+  s->mtimecmp.resize(procs.size());
+  s->msip.resize(procs.size());
+  for (size_t i = 0; i < procs.size(); i++) {
+    clint->load(CLINT_MTIMECMP_BASE + i * sizeof(s->mtimecmp[i]), sizeof(s->mtimecmp[i]),
+                (uint8_t*)&s->mtimecmp[i]);
+    clint->load(CLINT_MSIP_BASE + i * sizeof(s->msip[i]), sizeof(s->msip[i]),
+                (uint8_t*)&s->msip[i]);
+  }
+}
+
+// Memory must already hold the state's contents, since translated code is
+// dropped here.
+void sim_t::restore_machine_state(const machine_state_t& s)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    memcpy(procs[i]->get_state(), &s.harts[i * sizeof(state_t)], sizeof(state_t));
+    procs[i]->get_mmu()->flush_tlb();
+    procs[i]->yield_load_reservation();
+    block_caches[i]->flush();
+  }
+  in_wfi = s.in_wfi;
+  quantum = s.quantum;
+  preferred_quantum = s.preferred_quantum;
+  round_mmio = s.round_mmio;
+  round_htif = s.round_htif;
+  current_step = 0;
+  current_proc = 0;
+
+  events.reset(s.time);
+  clint_ticks = s.time / INSNS_PER_RTC_TICK;
+  uint64_t mtime = s.mtime;
+  clint->store(CLINT_MTIME_BASE, sizeof(mtime), (uint8_t*)&mtime);
+  for (size_t i = 0; i < procs.size(); i++) {
+    uint64_t mtimecmp = s.mtimecmp[i];
+    uint32_t msip = s.msip[i];
+    clint->store(CLINT_MTIMECMP_BASE + i * sizeof(mtimecmp), sizeof(mtimecmp), (uint8_t*)&mtimecmp);
+    clint->store(CLINT_MSIP_BASE + i * sizeof(msip), sizeof(msip), (uint8_t*)&msip);
+  }
+  clint->increment(0);
+  schedule_clint();
+
+  // Translated blocks check code_generation before they run again.
+  code_lines_reset();
+}
+
+void sim_t::save_snapshot(const char* path)
+{
+  if (remote_bitbang && remote_bitbang->connected())
+    fprintf(stderr, "snapshot %s: the debug module's state is not saved\n", path);
+
+  machine_state_t s;
+  save_machine_state(&s);
+
+  snapshot_file_t f(path, "wb");
+  snapshot_header_t h;
+  memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+  h.version = SNAPSHOT_VERSION;
+  h.state_size = sizeof(state_t);
+  h.nprocs = procs.size();
+  h.nmems = mems.size();
+  h.time = s.time;
+  f.put(h);
+  f.put<uint64_t>(s.quantum);
+  f.put<uint64_t>(s.preferred_quantum);
+  f.put<uint64_t>(s.round_mmio);
+  f.put<uint64_t>(s.round_htif);
+
+  for (size_t i = 0; i < procs.size(); i++) {
+    f.put_string(procs[i]->get_isa_string());
+    f.write(&s.harts[i * sizeof(state_t)], sizeof(state_t));
+    f.put(s.in_wfi[i]);
+    f.put(s.mtimecmp[i]);
+    f.put(s.msip[i]);
+  }
+  f.put(s.mtime);
+
+  // The ROM is a whole number of pages and refuses loads past its end.
+  std::vector<char> rom;
+  char page[SNAPSHOT_PAGE];
+  while (boot_rom->load(rom.size(), sizeof(page), (uint8_t*)page))
+    rom.insert(rom.end(), page, page + sizeof(page));
+  f.put<uint64_t>(rom.size());
+  f.write(rom.data(), rom.size());
+
+  for (auto& m : mems) {
+    const char* contents = m.second->contents();
+    size_t size = m.second->size();
+    f.put<uint64_t>(m.first);
+    f.put<uint64_t>(size);
+    for (size_t off = 0; off < size; off += SNAPSHOT_PAGE) {
+      size_t len = std::min(size - off, size_t(SNAPSHOT_PAGE));
+      if (memcmp(contents + off, zero_page, len) == 0)
+        continue;
+      f.put<uint64_t>(off);
+      f.write(contents + off, len);
+    }
+    f.put(SNAPSHOT_END);
+  }
+}
+
+void sim_t::load_snapshot(const char* path)
+{
+  snapshot_file_t f(path, "rb");
+  snapshot_header_t h = f.get<snapshot_header_t>();
+  if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0)
+    f.fail("not a snapshot");
+  if (h.version != SNAPSHOT_VERSION || h.state_size != sizeof(state_t))
+    f.fail("written by a different simulator build");
+  if (h.nprocs != procs.size() || h.nmems != mems.size())
+    f.fail("written with a different number of harts or memories");
+
+  machine_state_t s;
+  s.time = h.time;
+  s.quantum = f.get<uint64_t>();
+  s.preferred_quantum = f.get<uint64_t>();
+  s.round_mmio = f.get<uint64_t>();
+  s.round_htif = f.get<uint64_t>();
+  s.harts.resize(procs.size() * sizeof(state_t));
+  s.in_wfi.resize(procs.size());
+  s.mtimecmp.resize(procs.size());
+  s.msip.resize(procs.size());
+  for (size_t i = 0; i < procs.size(); i++) {
+    if (f.get_string() != procs[i]->get_isa_string())
+      f.fail("written with a different ISA");
+    f.read(&s.harts[i * sizeof(state_t)], sizeof(state_t));
+    s.in_wfi[i] = f.get<uint8_t>();
+    s.mtimecmp[i] = f.get<uint64_t>();
+    s.msip[i] = f.get<uint32_t>();
+  }
+  s.mtime = f.get<uint64_t>();
+
+  std::vector<char> rom(f.get<uint64_t>());
+  f.read(rom.data(), rom.size());
+  std::unique_ptr<rom_device_t> new_rom(new rom_device_t(rom));
+  bus.add_device(DEFAULT_RSTVEC, new_rom.get());
+  boot_rom = std::move(new_rom);
+
+  // Pages left out are zero; dropping them from the region leaves memory
+  // the program never touched untouched.
+  for (auto& m : mems) {
+    char* contents = m.second->contents();
+    size_t size = m.second->size();
+    if (f.get<uint64_t>() != m.first || f.get<uint64_t>() != size)
+      f.fail("written with a different memory layout");
+
+    size_t next = 0;
+    for (uint64_t off; (off = f.get<uint64_t>()) != SNAPSHOT_END; next = off + SNAPSHOT_PAGE) {
+      if (off < next || off >= size || off % SNAPSHOT_PAGE != 0)
+        f.fail("corrupt memory page list");
+      m.second->zero(next, off - next);
+      f.read(contents + off, std::min(size - off, size_t(SNAPSHOT_PAGE)));
+    }
+    next = std::min(next, size);
+    m.second->zero(next, size - next);
+  }
+
+  restore_machine_state(s);
+}
@@ -275,14 +275,14 @@ std::string disassembler_t::disassemble(insn_t insn) const
 disassembler_t::disassembler_t(int xlen)
 {
 
-  //由于位域发生变化，因此对此处进行修改
-  const uint32_t mask_rd = 0xfUL << 8;
-  const uint32_t match_rd_ra = 1UL << 8;
-  const uint32_t mask_rs1 = 0xfUL << 24;
-  const uint32_t match_rs1_ra = 1UL << 24;
-  const uint32_t mask_rs2 = 0xfUL << 20;
-  const uint32_t mask_imm = 0xfffUL << 12;
-  const uint32_t match_imm_1 = 1UL << 12;
+  // Field positions come from insn_format.h.
+  const uint32_t mask_rd = insn_rd_field_t::mask;
+  const uint32_t match_rd_ra = insn_rd_field_t::encode(X_RA);
+  const uint32_t mask_rs1 = insn_rs1_field_t::mask;
+  const uint32_t match_rs1_ra = insn_rs1_field_t::encode(X_RA);
+  const uint32_t mask_rs2 = insn_rs2_field_t::mask;
+  const uint32_t mask_imm = insn_i_imm_field_t::mask;
+  const uint32_t match_imm_1 = insn_i_imm_field_t::encode(1);
   // 压缩指令的相关内容，暂时先不改，不清楚如何设计的指令
   const uint32_t mask_rvc_rs2 = 0x1fUL << 2;
   const uint32_t mask_rvc_imm = mask_rvc_rs2 | 0x1000UL;
@@ -470,6 +470,7 @@ disassembler_t::disassembler_t(int xlen)
 */
   DEFINE_NOARG(ecall);
   DEFINE_NOARG(ebreak);
+  DEFINE_NOARG(wfi);
 /*  
   DEFINE_NOARG(uret);
   DEFINE_NOARG(sret);